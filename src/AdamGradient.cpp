@@ -6,6 +6,12 @@ AdamGradient::AdamGradient()
     : beta1(0.9f), beta2(0.999f), epsilon(10e-8), lr(0.001f), isFirstUpdate(true) {}
 
 math::Tensor AdamGradient::UpdateGradient(const math::Tensor &gradient) {
+  math::Tensor result = gradient;
+  UpdateGradientInPlace(result);
+  return result;
+}
+
+void AdamGradient::UpdateGradientInPlace(math::Tensor &gradient) {
   if (isFirstUpdate) {
     momentum = initialMomentum(gradient);
     rms = initialRMS(gradient);
@@ -15,7 +21,22 @@ math::Tensor AdamGradient::UpdateGradient(const math::Tensor &gradient) {
   updateMomentum(gradient);
   updateRMS(gradient);
 
-  return computeWeightUpdate();
+  computeWeightUpdate(gradient);
+}
+
+AdamGradient::State AdamGradient::GetState(void) const {
+  State result;
+  result.momentum = momentum;
+  result.rms = rms;
+  result.isFirstUpdate = isFirstUpdate;
+  return result;
+}
+
+void AdamGradient::SetState(const State &state) {
+  assert(state.momentum.NumLayers() == state.rms.NumLayers());
+  momentum = state.momentum;
+  rms = state.rms;
+  isFirstUpdate = state.isFirstUpdate;
 }
 
 math::Tensor AdamGradient::initialMomentum(const math::Tensor &gradient) {
@@ -36,38 +57,23 @@ math::Tensor AdamGradient::initialRMS(const math::Tensor &gradient) {
 
 void AdamGradient::updateMomentum(const math::Tensor &gradient) {
   assert(gradient.NumLayers() == momentum.NumLayers());
-  momentum = momentum * beta1 + gradient * (1.0f - beta1);
+  momentum.Axpby(1.0f - beta1, gradient, beta1);
 }
 
 void AdamGradient::updateRMS(const math::Tensor &gradient) {
   assert(gradient.NumLayers() == rms.NumLayers());
-
-  for (unsigned i = 0; i < gradient.NumLayers(); i++) {
-    assert(gradient(i).rows() == rms(i).rows());
-    assert(gradient(i).cols() == rms(i).cols());
-
-    for (int y = 0; y < gradient(i).rows(); y++) {
-      for (int x = 0; x < gradient(i).cols(); x++) {
-        rms(i)(y, x) =
-            beta2 * rms(i)(y, x) + (1.0f - beta2) * gradient(i)(y, x) * gradient(i)(y, x);
-      }
-    }
-  }
+  rms.AxpbySquared(1.0f - beta2, gradient, beta2);
 }
 
-math::Tensor AdamGradient::computeWeightUpdate(void) {
-  math::Tensor update = momentum; // just to get the dimensionality right.
-
-  for (unsigned i = 0; i < rms.NumLayers(); i++) {
-    for (int y = 0; y < rms(i).rows(); y++) {
-      for (int x = 0; x < rms(i).cols(); x++) {
-        float mc = momentum(i)(y, x) / (1.0f - beta1);
-        float rc = rms(i)(y, x) / (1.0f - beta2);
+void AdamGradient::computeWeightUpdate(math::Tensor &out) {
+  assert(out.NumLayers() == rms.NumLayers());
 
-        update(i)(y, x) = -lr * mc / sqrtf(rc + epsilon);
-      }
-    }
-  }
+  const float momentumScale = 1.0f / (1.0f - beta1);
+  const float rmsScale = 1.0f / (1.0f - beta2);
 
-  return update;
+  out.ForEachBlock([&](unsigned layer, unsigned start, unsigned size) {
+    out.Segment(layer, start, size) =
+        -lr * (momentum.Segment(layer, start, size) * momentumScale) /
+        (rms.Segment(layer, start, size) * rmsScale + epsilon).sqrt();
+  });
 }
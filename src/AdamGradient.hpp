@@ -4,11 +4,24 @@
 
 class AdamGradient {
 public:
+  // Everything needed to resume the optimiser exactly where it left off.
+  struct State {
+    math::Tensor momentum;
+    math::Tensor rms;
+    bool isFirstUpdate;
+  };
+
   AdamGradient(); // TODO: put in a non-default constructor that allows the params to be set.
   ~AdamGradient() = default;
 
   math::Tensor UpdateGradient(const math::Tensor &gradient);
 
+  // As above, but overwrites the gradient with the weight update rather than allocating one.
+  void UpdateGradientInPlace(math::Tensor &gradient);
+
+  State GetState(void) const;
+  void SetState(const State &state);
+
 private:
   const float beta1;
   const float beta2;
@@ -24,5 +37,5 @@ private:
 
   void updateMomentum(const math::Tensor &gradient);
   void updateRMS(const math::Tensor &gradient);
-  math::Tensor computeWeightUpdate(void);
+  void computeWeightUpdate(math::Tensor &out);
 };
@@ -5,15 +5,35 @@
 #include <fstream>
 #include <iostream>
 
+static vector<char> defaultVocabulary(void) {
+  vector<char> result = {' ', '.', '!', '?', '\"', '\'', '(', ')', '[', ']', '{', '}', '-',
+                         '@', '#', '$', '%', '&',  '*',  '<', '>', ':', ';', '/', '\\'};
+
+  for (char c = 'a'; c <= 'z'; c++) {
+    result.push_back(c);
+  }
+  for (char c = '0'; c <= '9'; c++) {
+    result.push_back(c);
+  }
+  return result;
+}
+
+static int normalisedCharacter(int curChar) {
+  if (isspace(curChar)) {
+    return ' ';
+  } else {
+    return tolower(curChar);
+  }
+}
+
 struct CharacterStream::CharacterStreamImpl {
   vector<char> mappedChars;
 
   std::ifstream fileStream;
   int prevChar;
 
-  CharacterStreamImpl(const string &filePath) : fileStream(filePath), prevChar(0) {
-    initMappedChars();
-  }
+  CharacterStreamImpl(const string &filePath)
+      : mappedChars(defaultVocabulary()), fileStream(filePath), prevChar(0) {}
 
   unsigned VectorDimension(void) const { return mappedChars.size(); }
 
@@ -65,26 +85,6 @@ struct CharacterStream::CharacterStreamImpl {
     assert(index < mappedChars.size());
     return mappedChars[index];
   }
-
-  void initMappedChars(void) {
-    mappedChars = {' ', '.', '!', '?', '\"', '\'', '(', ')', '[', ']', '{', '}', '-',
-                   '@', '#', '$', '%', '&',  '*',  '<', '>', ':', ';', '/', '\\'};
-
-    for (char c = 'a'; c <= 'z'; c++) {
-      mappedChars.push_back(c);
-    }
-    for (char c = '0'; c <= '9'; c++) {
-      mappedChars.push_back(c);
-    }
-  }
-
-  int normalisedCharacter(int curChar) {
-    if (isspace(curChar)) {
-      return ' ';
-    } else {
-      return tolower(curChar);
-    }
-  }
 };
 
 CharacterStream::CharacterStream(const string &filePath)
@@ -101,3 +101,25 @@ vector<math::OneHotVector> CharacterStream::ReadCharacters(unsigned max) {
 }
 
 char CharacterStream::Decode(unsigned index) const { return impl->Decode(index); }
+
+vector<char> CharacterStream::Vocabulary(void) { return defaultVocabulary(); }
+
+vector<unsigned> CharacterStream::Encode(const string &text) {
+  vector<char> vocabulary = defaultVocabulary();
+
+  vector<unsigned> result;
+  int prevChar = 0;
+  for (unsigned char c : text) {
+    int nextChar = normalisedCharacter(c);
+    if (nextChar == ' ' && nextChar == prevChar) {
+      continue;
+    }
+
+    auto mappedIter = find(vocabulary.begin(), vocabulary.end(), nextChar);
+    if (mappedIter != vocabulary.end()) {
+      prevChar = nextChar;
+      result.push_back(mappedIter - vocabulary.begin());
+    }
+  }
+  return result;
+}
@@ -18,6 +18,12 @@ public:
 
   char Decode(unsigned index) const;
 
+  // The characters a stream maps to vector indices, in index order.
+  static vector<char> Vocabulary(void);
+
+  // Maps text to vector indices the same way the stream does, dropping unmapped characters.
+  static vector<unsigned> Encode(const string &text);
+
 private:
   struct CharacterStreamImpl;
   uptr<CharacterStreamImpl> impl;
@@ -0,0 +1,397 @@
+
+#include "Checkpoint.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace neuralnetwork;
+using namespace neuralnetwork::rnn;
+
+static constexpr char CHECKPOINT_MAGIC[8] = {'C', 'H', 'A', 'R', 'R', 'N', 'N', '\0'};
+static constexpr uint32_t CHECKPOINT_VERSION = 1;
+static constexpr uint64_t DATA_ALIGNMENT = 64;
+
+namespace {
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t iteration;
+
+  uint32_t numInputs;
+  uint32_t numOutputs;
+  uint32_t hiddenActivation;
+  uint32_t outputActivation;
+  float nodeActivationRate;
+
+  uint32_t numLayers;
+  uint32_t numConnections;
+
+  uint32_t numWeights;
+  uint32_t numMomentum;
+  uint32_t numRMS;
+  uint32_t isFirstUpdate;
+  uint32_t padding;
+
+  uint64_t fileSize;
+};
+
+struct FileLayerSpec {
+  uint32_t uid;
+  uint32_t numNodes;
+  uint32_t isOutput;
+};
+
+struct FileConnection {
+  uint32_t srcLayerId;
+  uint32_t dstLayerId;
+  int32_t timeOffset;
+};
+
+struct FileMatrix {
+  uint32_t rows;
+  uint32_t cols;
+  uint64_t offset; // from the start of the file, aligned to DATA_ALIGNMENT.
+};
+}
+
+static uint64_t alignUp(uint64_t offset) {
+  return (offset + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+}
+
+static vector<const EMatrix *> allMatrices(const Checkpoint &checkpoint) {
+  vector<const EMatrix *> result;
+  for (const math::Tensor *t :
+       {&checkpoint.weights, &checkpoint.optimiser.momentum, &checkpoint.optimiser.rms}) {
+    for (unsigned i = 0; i < t->NumLayers(); i++) {
+      result.push_back(&(*t)(i));
+    }
+  }
+  return result;
+}
+
+bool WriteCheckpoint(const string &path, const Checkpoint &checkpoint) {
+  const RNNSpec &spec = checkpoint.spec;
+  vector<const EMatrix *> matrices = allMatrices(checkpoint);
+
+  FileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+  header.version = CHECKPOINT_VERSION;
+  header.iteration = checkpoint.iteration;
+  header.numInputs = spec.numInputs;
+  header.numOutputs = spec.numOutputs;
+  header.hiddenActivation = static_cast<uint32_t>(spec.hiddenActivation);
+  header.outputActivation = static_cast<uint32_t>(spec.outputActivation);
+  header.nodeActivationRate = spec.nodeActivationRate;
+  header.numLayers = spec.layers.size();
+  header.numConnections = spec.connections.size();
+  header.numWeights = checkpoint.weights.NumLayers();
+  header.numMomentum = checkpoint.optimiser.momentum.NumLayers();
+  header.numRMS = checkpoint.optimiser.rms.NumLayers();
+  header.isFirstUpdate = checkpoint.optimiser.isFirstUpdate ? 1 : 0;
+
+  vector<FileLayerSpec> layers;
+  for (const auto &ls : spec.layers) {
+    layers.push_back(FileLayerSpec{ls.uid, ls.numNodes, ls.isOutput ? 1u : 0u});
+  }
+
+  vector<FileConnection> connections;
+  for (const auto &lc : spec.connections) {
+    connections.push_back(FileConnection{lc.srcLayerId, lc.dstLayerId, lc.timeOffset});
+  }
+
+  uint64_t offset = sizeof(FileHeader) + layers.size() * sizeof(FileLayerSpec) +
+                    connections.size() * sizeof(FileConnection) +
+                    matrices.size() * sizeof(FileMatrix);
+
+  vector<FileMatrix> table;
+  for (const EMatrix *m : matrices) {
+    offset = alignUp(offset);
+    table.push_back(FileMatrix{static_cast<uint32_t>(m->rows()), static_cast<uint32_t>(m->cols()),
+                               offset});
+    offset += m->size() * sizeof(float);
+  }
+  header.fileSize = offset;
+
+  string tmpPath = path + ".tmp";
+  std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return false;
+  }
+
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(layers.data()), layers.size() * sizeof(FileLayerSpec));
+  out.write(reinterpret_cast<const char *>(connections.data()),
+            connections.size() * sizeof(FileConnection));
+  out.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(FileMatrix));
+
+  static const char zeros[DATA_ALIGNMENT] = {0};
+  for (unsigned i = 0; i < matrices.size(); i++) {
+    uint64_t pos = out.tellp();
+    assert(pos <= table[i].offset && table[i].offset - pos < DATA_ALIGNMENT);
+    out.write(zeros, table[i].offset - pos);
+    // Stored column major whatever the build's EMatrix layout, copying only when they differ.
+    const EColMatrix &m = *matrices[i];
+    out.write(reinterpret_cast<const char *>(m.data()), m.size() * sizeof(float));
+  }
+
+  out.close();
+  if (!out) {
+    remove(tmpPath.c_str());
+    return false;
+  }
+
+  return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
+
+// Whether a matrix lies inside the file, written so that a corrupt offset cannot wrap around.
+static bool isInFile(const FileMatrix &fm, uint64_t fileSize) {
+  uint64_t bytes = static_cast<uint64_t>(fm.rows) * fm.cols * sizeof(float);
+  return fm.offset % DATA_ALIGNMENT == 0 && bytes <= fileSize && fm.offset <= fileSize - bytes;
+}
+
+// Reads count matrices, each of which must have the corresponding shape in shapes.
+static bool readTensor(const char *base, uint64_t fileSize, const FileMatrix *table,
+                       const vector<pair<unsigned, unsigned>> &shapes, math::Tensor &out) {
+  for (unsigned i = 0; i < shapes.size(); i++) {
+    const FileMatrix &fm = table[i];
+    if (fm.rows != shapes[i].first || fm.cols != shapes[i].second || !isInFile(fm, fileSize)) {
+      return false;
+    }
+
+    const float *data = reinterpret_cast<const float *>(base + fm.offset);
+    out.AddLayer(Eigen::Map<const EColMatrix>(data, fm.rows, fm.cols));
+  }
+  return true;
+}
+
+static const FileLayerSpec *findLayer(const FileLayerSpec *layers, unsigned numLayers,
+                                      unsigned uid) {
+  for (unsigned i = 0; i < numLayers; i++) {
+    if (layers[i].uid == uid) {
+      return &layers[i];
+    }
+  }
+  return nullptr;
+}
+
+// Checks the topology against everything RNN and InferenceModel assert on, and returns the shape
+// of every weight matrix in the order RNN::GetWeights produces them: layers in spec order, and for
+// each layer its incoming connections in spec order, each (numNodes, srcOutputs + 1).
+static Maybe<vector<pair<unsigned, unsigned>>> weightShapes(const FileHeader &header,
+                                                            const FileLayerSpec *layers,
+                                                            const FileConnection *connections) {
+  const auto none = Maybe<vector<pair<unsigned, unsigned>>>::none;
+  const uint32_t lastActivation = static_cast<uint32_t>(LayerActivation::SOFTMAX);
+  if (header.numInputs == 0 || header.hiddenActivation > lastActivation ||
+      header.outputActivation > lastActivation) {
+    return none;
+  }
+
+  unsigned numOutputLayers = 0;
+  for (unsigned i = 0; i < header.numLayers; i++) {
+    const FileLayerSpec &ls = layers[i];
+    if (ls.uid == 0 || ls.numNodes == 0 || findLayer(layers, i, ls.uid) != nullptr) {
+      return none;
+    }
+    if (ls.isOutput != 0) {
+      numOutputLayers++;
+      if (ls.numNodes != header.numOutputs) {
+        return none;
+      }
+    }
+  }
+  if (numOutputLayers != 1) {
+    return none;
+  }
+
+  vector<pair<unsigned, unsigned>> result;
+  for (unsigned i = 0; i < header.numLayers; i++) {
+    for (unsigned j = 0; j < header.numConnections; j++) {
+      const FileConnection &fc = connections[j];
+      if (findLayer(layers, header.numLayers, fc.dstLayerId) == nullptr ||
+          (fc.timeOffset != 0 && fc.timeOffset != 1)) {
+        return none;
+      }
+      if (fc.dstLayerId != layers[i].uid) {
+        continue;
+      }
+
+      // Same-step sources must be evaluated before this layer.
+      const FileLayerSpec *src =
+          findLayer(layers, fc.timeOffset == 0 ? i : header.numLayers, fc.srcLayerId);
+      // The input is only read in the step it is given.
+      if (fc.srcLayerId == 0 ? fc.timeOffset != 0 : src == nullptr) {
+        return none;
+      }
+
+      unsigned srcOutputs = fc.srcLayerId == 0 ? header.numInputs : src->numNodes;
+      result.emplace_back(layers[i].numNodes, srcOutputs + 1);
+    }
+  }
+  return Maybe<vector<pair<unsigned, unsigned>>>(result);
+}
+
+static Maybe<Checkpoint> parseCheckpoint(const char *base, uint64_t fileSize) {
+  if (fileSize < sizeof(FileHeader)) {
+    return Maybe<Checkpoint>::none;
+  }
+
+  const FileHeader *header = reinterpret_cast<const FileHeader *>(base);
+  if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 ||
+      header->version != CHECKPOINT_VERSION || header->fileSize != fileSize) {
+    return Maybe<Checkpoint>::none;
+  }
+
+  uint64_t numMatrices = static_cast<uint64_t>(header->numWeights) + header->numMomentum +
+                         header->numRMS;
+  uint64_t tablesEnd = sizeof(FileHeader) +
+                       static_cast<uint64_t>(header->numLayers) * sizeof(FileLayerSpec) +
+                       static_cast<uint64_t>(header->numConnections) * sizeof(FileConnection) +
+                       numMatrices * sizeof(FileMatrix);
+  if (tablesEnd > fileSize) {
+    return Maybe<Checkpoint>::none;
+  }
+
+  const char *cur = base + sizeof(FileHeader);
+  const FileLayerSpec *layers = reinterpret_cast<const FileLayerSpec *>(cur);
+  cur += header->numLayers * sizeof(FileLayerSpec);
+  const FileConnection *connections = reinterpret_cast<const FileConnection *>(cur);
+  cur += header->numConnections * sizeof(FileConnection);
+  const FileMatrix *table = reinterpret_cast<const FileMatrix *>(cur);
+
+  Maybe<vector<pair<unsigned, unsigned>>> shapes = weightShapes(*header, layers, connections);
+  if (!shapes.valid() || header->numWeights != shapes.val().size()) {
+    return Maybe<Checkpoint>::none;
+  }
+
+  // The optimiser moments are shaped like the weights, or absent before the first update.
+  bool haveMoments = header->numMomentum == header->numWeights &&
+                     header->numRMS == header->numWeights;
+  bool noMoments = header->numMomentum == 0 && header->numRMS == 0 && header->isFirstUpdate != 0;
+  if (!haveMoments && !noMoments) {
+    return Maybe<Checkpoint>::none;
+  }
+  vector<pair<unsigned, unsigned>> momentShapes;
+  if (haveMoments) {
+    momentShapes = shapes.val();
+  }
+
+  Checkpoint result;
+  result.iteration = header->iteration;
+  result.spec.numInputs = header->numInputs;
+  result.spec.numOutputs = header->numOutputs;
+  result.spec.hiddenActivation = static_cast<LayerActivation>(header->hiddenActivation);
+  result.spec.outputActivation = static_cast<LayerActivation>(header->outputActivation);
+  result.spec.nodeActivationRate = header->nodeActivationRate;
+
+  for (unsigned i = 0; i < header->numLayers; i++) {
+    result.spec.layers.emplace_back(layers[i].uid, layers[i].numNodes, layers[i].isOutput != 0);
+  }
+  for (unsigned i = 0; i < header->numConnections; i++) {
+    result.spec.connections.emplace_back(connections[i].srcLayerId, connections[i].dstLayerId,
+                                         connections[i].timeOffset);
+  }
+
+  result.optimiser.isFirstUpdate = header->isFirstUpdate != 0;
+
+  if (!readTensor(base, fileSize, table, shapes.val(), result.weights) ||
+      !readTensor(base, fileSize, table + header->numWeights, momentShapes,
+                  result.optimiser.momentum) ||
+      !readTensor(base, fileSize, table + header->numWeights + header->numMomentum, momentShapes,
+                  result.optimiser.rms)) {
+    return Maybe<Checkpoint>::none;
+  }
+
+  return Maybe<Checkpoint>(result);
+}
+
+Maybe<Checkpoint> ReadCheckpoint(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Maybe<Checkpoint>::none;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return Maybe<Checkpoint>::none;
+  }
+
+  void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return Maybe<Checkpoint>::none;
+  }
+
+  Maybe<Checkpoint> result = parseCheckpoint(static_cast<const char *>(mapped), st.st_size);
+  munmap(mapped, st.st_size);
+  return result;
+}
+
+struct CheckpointWriter::CheckpointWriterImpl {
+  string path;
+
+  std::mutex m;
+  std::condition_variable cv;
+  Maybe<Checkpoint> pending;
+  bool stop;
+
+  std::thread worker;
+
+  CheckpointWriterImpl(const string &path) : path(path), stop(false) {
+    worker = std::thread([this]() { this->writeLoop(); });
+  }
+
+  ~CheckpointWriterImpl() {
+    {
+      std::unique_lock<std::mutex> lock(m);
+      stop = true;
+    }
+    cv.notify_one();
+    worker.join();
+  }
+
+  void Write(Checkpoint &&snapshot) {
+    {
+      std::unique_lock<std::mutex> lock(m);
+      pending = Maybe<Checkpoint>(std::move(snapshot));
+    }
+    cv.notify_one();
+  }
+
+  void writeLoop(void) {
+    while (true) {
+      Maybe<Checkpoint> next;
+      {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [this]() { return stop || pending.valid(); });
+        if (!pending.valid()) {
+          return; // stopping with nothing left to write.
+        }
+        next = std::move(pending);
+      }
+
+      if (!WriteCheckpoint(path, next.val())) {
+        cerr << "failed to write checkpoint: " << path << endl;
+      }
+    }
+  }
+};
+
+CheckpointWriter::CheckpointWriter(const string &path) : impl(new CheckpointWriterImpl(path)) {}
+
+CheckpointWriter::~CheckpointWriter() = default;
+
+void CheckpointWriter::Write(Checkpoint &&snapshot) { impl->Write(std::move(snapshot)); }
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "AdamGradient.hpp"
+#include "common/Common.hpp"
+#include "common/Maybe.hpp"
+#include "math/Tensor.hpp"
+#include "neuralnetwork/rnn/RNNSpec.hpp"
+
+// A snapshot of an RNN training run: topology, weights and optimiser moments.
+//
+// On disk a checkpoint is a fixed header, the layer and connection specs, a table of matrix
+// descriptors, and then the raw matrix data. Every matrix is stored column-major (the EMatrix
+// layout) starting on a 64 byte boundary, so a mapped file can be wrapped by an Eigen::Map without
+// any parsing. Values are written in host byte order.
+struct Checkpoint {
+  unsigned iteration;
+  neuralnetwork::rnn::RNNSpec spec;
+  math::Tensor weights;
+  AdamGradient::State optimiser;
+};
+
+// Writes to a temporary file first and renames it over the path, so an interrupted write never
+// clobbers the previous checkpoint.
+bool WriteCheckpoint(const string &path, const Checkpoint &checkpoint);
+Maybe<Checkpoint> ReadCheckpoint(const string &path);
+
+// Writes checkpoints on a background thread so the training loop never waits on the disk. If a
+// new snapshot arrives while the previous one is still pending, only the newest is written.
+class CheckpointWriter {
+public:
+  CheckpointWriter(const string &path);
+  ~CheckpointWriter(); // blocks until the last pending snapshot is written.
+
+  void Write(Checkpoint &&snapshot);
+
+private:
+  struct CheckpointWriterImpl;
+  uptr<CheckpointWriterImpl> impl;
+};
@@ -0,0 +1,111 @@
+#include "FFNetworkReport.hpp"
+#include "CharacterStream.hpp"
+#include "common/Benchmark.hpp"
+#include "neuralnetwork/Network.hpp"
+#include "neuralnetwork/TrainingBatch.hpp"
+
+#include <cassert>
+#include <cstdlib>
+
+using namespace neuralnetwork;
+
+static constexpr unsigned TRAINING_TRIALS = 10;
+
+static NetworkSpec benchmarkSpec(unsigned nGramSize, unsigned maxBatchSize) {
+  const unsigned numLetters = CharacterStream::Vocabulary().size();
+
+  NetworkSpec spec;
+  spec.numInputs = nGramSize * numLetters;
+  spec.numOutputs = numLetters;
+  spec.hiddenLayers = {spec.numInputs, spec.numInputs / 2, spec.numInputs / 4};
+  spec.nodeActivationRate = 1.0f;
+  spec.maxBatchSize = maxBatchSize;
+  spec.hiddenActivation = LayerActivation::TANH;
+  spec.outputActivation = LayerActivation::SOFTMAX;
+  return spec;
+}
+
+// One random letter per n-gram position, as the indices of the ones of each sample's input.
+static vector<unsigned> randomContexts(unsigned nGramSize, unsigned numContexts) {
+  const unsigned numLetters = CharacterStream::Vocabulary().size();
+
+  vector<unsigned> result(numContexts * nGramSize);
+  for (unsigned i = 0; i < result.size(); i++) {
+    result[i] = (i % nGramSize) * numLetters + rand() % numLetters;
+  }
+  return result;
+}
+
+SparseTrainingReport BenchmarkSparseTraining(unsigned nGramSize, unsigned batchSize,
+                                             NetworkBackendType backendType) {
+  assert(nGramSize > 0 && batchSize > 0);
+
+  NetworkSpec spec = benchmarkSpec(nGramSize, batchSize);
+  Network network(spec, backendType);
+
+  TrainingBatch sparse;
+  sparse.ResizeSparse(batchSize, nGramSize, spec.numOutputs);
+  sparse.activeInputs = randomContexts(nGramSize, batchSize);
+  sparse.outputs.setZero();
+  for (unsigned i = 0; i < batchSize; i++) {
+    sparse.outputs(i, rand() % spec.numOutputs) = 1.0f;
+  }
+
+  TrainingBatch dense;
+  dense.ResizeDense(batchSize, spec.numInputs, spec.numOutputs);
+  dense.inputs.setZero();
+  for (unsigned i = 0; i < sparse.activeInputs.size(); i++) {
+    dense.inputs(i / nGramSize, sparse.activeInputs[i]) = 1.0f;
+  }
+  dense.outputs = sparse.outputs;
+
+  SparseTrainingReport result;
+  result.nGramSize = nGramSize;
+  result.batchSize = batchSize;
+  result.sparseMillis =
+      MicrosPerCall([&]() { network.Update(sparse); }, TRAINING_TRIALS, 1) / 1000.0;
+  result.denseMillis =
+      MicrosPerCall([&]() { network.Update(dense); }, TRAINING_TRIALS, 1) / 1000.0;
+  return result;
+}
+
+SparseInferenceReport BenchmarkSparseInference(unsigned nGramSize, unsigned numContexts,
+                                               NetworkBackendType backendType) {
+  assert(nGramSize > 0 && numContexts > 0);
+
+  NetworkSpec spec = benchmarkSpec(nGramSize, numContexts);
+  Network network(spec, backendType);
+
+  vector<unsigned> activeInputs = randomContexts(nGramSize, numContexts);
+  vector<EVector> inputs(numContexts, EVector::Zero(spec.numInputs));
+  for (unsigned i = 0; i < activeInputs.size(); i++) {
+    inputs[i / nGramSize](activeInputs[i]) = 1.0f;
+  }
+
+  SparseInferenceReport result;
+  result.nGramSize = nGramSize;
+  result.numContexts = numContexts;
+  result.batchMicros =
+      MicrosPerCall([&]() { network.ProcessSparse(activeInputs, nGramSize); }) / numContexts;
+  result.singleMicros = MicrosPerCall([&]() {
+    for (const auto &input : inputs) {
+      network.Process(input);
+    }
+  }) / numContexts;
+  return result;
+}
+
+ostream &operator<<(ostream &stream, const SparseTrainingReport &report) {
+  stream << report.nGramSize << "-gram training step, batch " << report.batchSize << ": "
+         << report.sparseMillis << "ms sparse, " << report.denseMillis << "ms dense ("
+         << report.denseMillis / report.sparseMillis << "x)";
+  return stream;
+}
+
+ostream &operator<<(ostream &stream, const SparseInferenceReport &report) {
+  stream << report.nGramSize << "-gram inference of " << report.numContexts
+         << " contexts, per context: " << report.batchMicros << "us sparse batch, "
+         << report.singleMicros << "us single (" << report.singleMicros / report.batchMicros
+         << "x)";
+  return stream;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "common/Common.hpp"
+#include "neuralnetwork/NetworkBackend.hpp"
+
+// Time per call of the feed forward language network, built as FFNetworkTrainer builds it for
+// n-grams of the given size over the letters.
+
+// Milliseconds per training step on a batch of random n-grams, given as sparse one-hot indices
+// and as the same inputs expanded to dense rows.
+struct SparseTrainingReport {
+  unsigned nGramSize;
+  unsigned batchSize;
+  double sparseMillis;
+  double denseMillis;
+};
+
+SparseTrainingReport BenchmarkSparseTraining(unsigned nGramSize, unsigned batchSize,
+                                             neuralnetwork::NetworkBackendType backendType);
+
+// Microseconds per context to compute the distributions after numContexts random n-grams, with one
+// ProcessSparse call for all of them and with a Process call for each.
+struct SparseInferenceReport {
+  unsigned nGramSize;
+  unsigned numContexts;
+  double batchMicros;
+  double singleMicros;
+};
+
+SparseInferenceReport BenchmarkSparseInference(unsigned nGramSize, unsigned numContexts,
+                                               neuralnetwork::NetworkBackendType backendType);
+
+ostream &operator<<(ostream &stream, const SparseTrainingReport &report);
+ostream &operator<<(ostream &stream, const SparseInferenceReport &report);
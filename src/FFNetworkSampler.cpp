@@ -1,43 +1,153 @@
 
 #include "FFNetworkSampler.hpp"
+#include "NGramCache.hpp"
 #include <cassert>
+#include <cmath>
+#include <unordered_map>
+
+using namespace neuralnetwork;
+
+// Contexts run through the network at a time when prefetching.
+static constexpr unsigned PREFETCH_BATCH = 256;
 
 struct FFNetworkSampler::FFNetworkSamplerImpl {
   unsigned nGramSize;
   unsigned letterDim;
 
+  uptr<NGramCache> cache;
+  Network *cachedNetwork;
+
   FFNetworkSamplerImpl(unsigned nGramSize, unsigned letterDim)
-      : nGramSize(nGramSize), letterDim(letterDim) {
+      : nGramSize(nGramSize), letterDim(letterDim), cachedNetwork(nullptr) {
     assert(nGramSize > 0);
     assert(letterDim > 0);
   }
 
-  vector<unsigned> SampleCharacters(neuralnetwork::Network *network, unsigned numChars) {
-    vector<unsigned> result;
-    result.reserve(numChars);
+  void EnableContextCache(unsigned capacity) {
+    // The packed contexts have to fit their 64 bit keys.
+    double numContexts = pow(static_cast<double>(letterDim + 1), static_cast<double>(nGramSize));
+    assert(numContexts < 1.8e19);
+
+    cache = make_unique<NGramCache>(capacity, letterDim);
+    cachedNetwork = nullptr;
+  }
+
+  void PrefetchContexts(Network *network, const vector<unsigned> &text, unsigned numContexts) {
+    assert(cache != nullptr);
+    useNetwork(network);
+
+    // How often each context precedes a character of the text, and where it first does.
+    unordered_map<uint64_t, pair<unsigned, unsigned>> counts;
+    for (unsigned i = 0; i < text.size(); i++) {
+      auto it = counts.emplace(contextKey(text, i), make_pair(0u, i)).first;
+      it->second.first++;
+    }
+
+    vector<pair<unsigned, unsigned>> byCount; // (count, position)
+    byCount.reserve(counts.size());
+    for (const auto &entry : counts) {
+      byCount.push_back(entry.second);
+    }
+    sort(byCount.begin(), byCount.end(), greater<pair<unsigned, unsigned>>());
+    byCount.resize(min<size_t>(byCount.size(), min(numContexts, cache->Capacity())));
+
+    vector<unsigned> activeInputs;
+    for (unsigned start = 0; start < byCount.size(); start += PREFETCH_BATCH) {
+      unsigned end = min<unsigned>(start + PREFETCH_BATCH, byCount.size());
+
+      activeInputs.resize((end - start) * nGramSize);
+      for (unsigned i = start; i < end; i++) {
+        contextInputs(text, byCount[i].second, &activeInputs[(i - start) * nGramSize]);
+      }
+
+      EMatrix pChars = network->ProcessSparse(activeInputs, nGramSize);
+      for (unsigned i = start; i < end; i++) {
+        cache->Insert(contextKey(text, byCount[i].second), pChars.col(i - start), true);
+      }
+    }
+  }
+
+  vector<vector<unsigned>> SampleCharacters(Network *network, unsigned numChars,
+                                            unsigned numStreams) {
+    assert(numStreams > 0);
+    if (cache != nullptr) {
+      useNetwork(network);
+    }
+
+    vector<vector<unsigned>> result(numStreams);
+    for (auto &stream : result) {
+      stream.reserve(numChars);
+    }
+
+    vector<uint64_t> keys(numStreams);
+    vector<unsigned> misses;
+    vector<unsigned> activeInputs;
+    EMatrix pChars(letterDim, numStreams);
+    EVector pChar;
 
     for (unsigned i = 0; i < numChars; i++) {
-      unsigned sample = sampleChar(network, result);
-      result.push_back(sample);
+      misses.clear();
+      for (unsigned s = 0; s < numStreams; s++) {
+        keys[s] = contextKey(result[s], result[s].size());
+        if (cache != nullptr && cache->Lookup(keys[s], pChar)) {
+          pChars.col(s) = pChar;
+        } else {
+          misses.push_back(s);
+        }
+      }
+
+      // Only the contexts that missed the cache go through the network.
+      if (!misses.empty()) {
+        activeInputs.resize(misses.size() * nGramSize);
+        for (unsigned m = 0; m < misses.size(); m++) {
+          const vector<unsigned> &stream = result[misses[m]];
+          contextInputs(stream, stream.size(), &activeInputs[m * nGramSize]);
+        }
+
+        EMatrix missed = network->ProcessSparse(activeInputs, nGramSize);
+        for (unsigned m = 0; m < misses.size(); m++) {
+          pChars.col(misses[m]) = missed.col(m);
+          if (cache != nullptr) {
+            cache->Insert(keys[misses[m]], missed.col(m), false);
+          }
+        }
+      }
+
+      for (unsigned s = 0; s < numStreams; s++) {
+        result[s].push_back(sampleChar(pChars.col(s)));
+      }
     }
 
     return result;
   }
 
-  unsigned sampleChar(neuralnetwork::Network *network, const vector<unsigned> &prevChars) {
-    EVector input(nGramSize * letterDim);
-    input.fill(0.0f);
+  void useNetwork(Network *network) {
+    if (network != cachedNetwork) {
+      cache->Clear();
+      cachedNetwork = network;
+    }
+  }
 
+  // The nGramSize characters before end packed into an integer, a digit per character with 0
+  // before the start of the text.
+  uint64_t contextKey(const vector<unsigned> &chars, unsigned end) const {
+    uint64_t key = 0;
     for (unsigned i = 0; i < nGramSize; i++) {
-      int prevCharsIndex = prevChars.size() - i - 1;
-      if (prevCharsIndex < 0) {
-        break;
-      }
+      int index = static_cast<int>(end) - static_cast<int>(nGramSize) + i;
+      key = key * (letterDim + 1) + (index < 0 ? 0 : chars[index] + 1);
+    }
+    return key;
+  }
 
-      input((nGramSize - i - 1) * letterDim + prevChars[prevCharsIndex]) = 1.0f;
+  // The one-hot n-gram of the nGramSize characters before end, as the indices of its ones.
+  void contextInputs(const vector<unsigned> &chars, unsigned end, unsigned *out) const {
+    for (unsigned i = 0; i < nGramSize; i++) {
+      int index = static_cast<int>(end) - static_cast<int>(nGramSize) + i;
+      out[i] = index < 0 ? NO_ACTIVE_INPUT : i * letterDim + chars[index];
     }
+  }
 
-    EVector pChar = network->Process(input);
+  unsigned sampleChar(const EVector &pChar) {
     float r = math::UnitRand();
 
     for (int i = 0; i < pChar.rows(); i++) {
@@ -56,7 +166,20 @@ FFNetworkSampler::FFNetworkSampler(unsigned nGramSize, unsigned letterDim)
 
 FFNetworkSampler::~FFNetworkSampler() = default;
 
+void FFNetworkSampler::EnableContextCache(unsigned capacity) { impl->EnableContextCache(capacity); }
+
+void FFNetworkSampler::PrefetchContexts(neuralnetwork::Network *network,
+                                        const vector<unsigned> &text, unsigned numContexts) {
+  impl->PrefetchContexts(network, text, numContexts);
+}
+
 vector<unsigned> FFNetworkSampler::SampleCharacters(neuralnetwork::Network *network,
                                                     unsigned numChars) {
-  return impl->SampleCharacters(network, numChars);
+  return impl->SampleCharacters(network, numChars, 1).front();
+}
+
+vector<vector<unsigned>> FFNetworkSampler::SampleCharacters(neuralnetwork::Network *network,
+                                                            unsigned numChars,
+                                                            unsigned numStreams) {
+  return impl->SampleCharacters(network, numChars, numStreams);
 }
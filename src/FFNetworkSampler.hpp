@@ -9,8 +9,23 @@ public:
   FFNetworkSampler(unsigned nGramSize, unsigned letterDim);
   ~FFNetworkSampler();
 
+  // Memoises the network's output for up to capacity n-gram contexts, so repeated contexts skip
+  // the network. The cache assumes the network is not updated while it is in use; enabling it
+  // again starts it afresh.
+  void EnableContextCache(unsigned capacity);
+
+  // Fills the cache with the distributions of the numContexts most frequent contexts in text
+  // (vocabulary indices), which stay cached for as long as the network does.
+  void PrefetchContexts(neuralnetwork::Network *network, const vector<unsigned> &text,
+                        unsigned numContexts);
+
   vector<unsigned> SampleCharacters(neuralnetwork::Network *network, unsigned numChars);
 
+  // Generates numStreams independent sequences. Each character is sampled for all of the streams
+  // from a single batched network call.
+  vector<vector<unsigned>> SampleCharacters(neuralnetwork::Network *network, unsigned numChars,
+                                            unsigned numStreams);
+
 private:
   struct FFNetworkSamplerImpl;
   uptr<FFNetworkSamplerImpl> impl;
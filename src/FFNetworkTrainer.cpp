@@ -1,7 +1,10 @@
 
 #include "FFNetworkTrainer.hpp"
-#include "neuralnetwork/SamplesProvider.hpp"
-#include "neuralnetwork/TrainingSample.hpp"
+#include "neuralnetwork/TrainingBatch.hpp"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
 #include <cassert>
 
 using namespace neuralnetwork;
@@ -11,20 +14,42 @@ static constexpr unsigned BATCH_SIZE = 500;
 
 struct FFNetworkTrainer::FFNetworkTrainerImpl {
   unsigned nGramSize;
+  NetworkBackendType backendType;
 
-  FFNetworkTrainerImpl(unsigned nGramSize) : nGramSize(nGramSize) { assert(nGramSize >= 1); }
+  FFNetworkTrainerImpl(unsigned nGramSize, NetworkBackendType backendType)
+      : nGramSize(nGramSize), backendType(backendType) {
+    assert(nGramSize >= 1);
+  }
 
   uptr<Network> TrainLanguageNetwork(CharacterStream &cStream, unsigned iters) {
-    uptr<Network> network =
-        createNewNetwork(nGramSize * cStream.VectorDimension(), cStream.VectorDimension());
+    const unsigned dim = cStream.VectorDimension();
+    uptr<Network> network = createNewNetwork(nGramSize * dim, dim);
 
-    vector<math::OneHotVector> letters = cStream.ReadCharacters(NUM_LETTERS);
-    vector<TrainingSample> allSamples = makeTrainingSamples(letters, cStream.VectorDimension());
-    random_shuffle(allSamples.begin(), allSamples.end());
+    vector<unsigned> tokens = readTokens(cStream);
+    assert(!tokens.empty());
+
+    // Samples are identified by the position of their target letter, and shuffled as such.
+    vector<unsigned> order(tokens.size());
+    for (unsigned i = 0; i < order.size(); i++) {
+      order[i] = i;
+    }
+    random_shuffle(order.begin(), order.end());
+
+    // The inputs are sparse, one active input per n-gram letter.
+    TrainingBatch batch;
+    batch.ResizeSparse(BATCH_SIZE, nGramSize, dim);
 
     for (unsigned i = 0; i < iters; i++) {
-      auto samplesProvider = SamplesProvider(allSamples, BATCH_SIZE, rand() % allSamples.size());
-      network->Update(samplesProvider);
+      const unsigned offset = rand() % order.size();
+      tbb::parallel_for(tbb::blocked_range<unsigned>(0, BATCH_SIZE, 64),
+                        [this, offset, dim, &tokens, &order,
+                         &batch](const tbb::blocked_range<unsigned> &r) {
+                          for (unsigned j = r.begin(); j != r.end(); j++) {
+                            fillSample(tokens, order[(offset + j) % order.size()], dim, j, batch);
+                          }
+                        });
+
+      network->Update(batch);
 
       if (i % 100 == 0) {
         unsigned percentDone = (100 * i) / iters;
@@ -36,47 +61,28 @@ struct FFNetworkTrainer::FFNetworkTrainerImpl {
     return move(network);
   }
 
-  vector<TrainingSample> makeTrainingSamples(const vector<math::OneHotVector> &lettersStream,
-                                             unsigned dim) {
-    EVector zero(dim);
-    zero.fill(0.0f);
-
-    vector<EVector> prevLetters(nGramSize, zero);
-    unsigned head = 0;
-    unsigned tail = prevLetters.size() - 1;
-
-    vector<TrainingSample> result;
-    result.reserve(NUM_LETTERS);
-
-    for (const auto &letter : lettersStream) {
-      EVector letterVec = zero;
-      letterVec(letter.index) = 1.0f;
-
-      result.push_back(sampleFromLetters(prevLetters, head, letterVec));
+  vector<unsigned> readTokens(CharacterStream &cStream) {
+    vector<math::OneHotVector> letters = cStream.ReadCharacters(NUM_LETTERS);
 
-      head = (head + 1) % prevLetters.size();
-      tail = (tail + 1) % prevLetters.size();
-      prevLetters[tail] = letterVec;
+    vector<unsigned> result;
+    result.reserve(letters.size());
+    for (const auto &letter : letters) {
+      result.push_back(letter.index);
     }
-
     return result;
   }
 
-  TrainingSample sampleFromLetters(const vector<EVector> &prevLetters, unsigned head,
-                                   const EVector &curLetter) {
-    assert(prevLetters.size() > 0);
-
-    EVector input(prevLetters.size() * prevLetters[0].rows());
-    unsigned j = 0;
-
-    for (unsigned i = 0; i < prevLetters.size(); i++) {
-      unsigned index = (head + i) % prevLetters.size();
-      for (int lr = 0; lr < prevLetters[index].rows(); lr++) {
-        input(j++) = prevLetters[index](lr);
-      }
+  // The input is the nGramSize letters before pos, oldest first and zero before the start of the
+  // text, and the expected output is the letter at pos.
+  void fillSample(const vector<unsigned> &tokens, unsigned pos, unsigned dim, unsigned row,
+                  TrainingBatch &out) {
+    for (unsigned i = 0; i < nGramSize; i++) {
+      out.activeInputs[row * nGramSize + i] =
+          pos + i >= nGramSize ? i * dim + tokens[pos + i - nGramSize] : NO_ACTIVE_INPUT;
     }
 
-    return TrainingSample(input, curLetter);
+    out.outputs.row(row).setZero();
+    out.outputs(row, tokens[pos]) = 1.0f;
   }
 
   uptr<Network> createNewNetwork(unsigned inputSize, unsigned outputSize) {
@@ -89,12 +95,12 @@ struct FFNetworkTrainer::FFNetworkTrainerImpl {
     spec.hiddenActivation = LayerActivation::TANH;
     spec.outputActivation = LayerActivation::SOFTMAX;
 
-    return make_unique<Network>(spec);
+    return make_unique<Network>(spec, backendType);
   }
 };
 
-FFNetworkTrainer::FFNetworkTrainer(unsigned nGramSize)
-    : impl(new FFNetworkTrainerImpl(nGramSize)) {}
+FFNetworkTrainer::FFNetworkTrainer(unsigned nGramSize, NetworkBackendType backendType)
+    : impl(new FFNetworkTrainerImpl(nGramSize, backendType)) {}
 
 FFNetworkTrainer::~FFNetworkTrainer() = default;
 
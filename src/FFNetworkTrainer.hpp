@@ -6,7 +6,7 @@
 
 class FFNetworkTrainer {
 public:
-  FFNetworkTrainer(unsigned nGramSize);
+  FFNetworkTrainer(unsigned nGramSize, neuralnetwork::NetworkBackendType backendType);
   ~FFNetworkTrainer();
 
   uptr<neuralnetwork::Network> TrainLanguageNetwork(CharacterStream &cStream, unsigned iters);
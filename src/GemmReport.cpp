@@ -0,0 +1,105 @@
+#include "GemmReport.hpp"
+#include "common/Benchmark.hpp"
+#include "math/SmallGemm.hpp"
+
+#include <cassert>
+
+GemmReport BenchmarkGemm(unsigned layerSize, unsigned batchSize) {
+  assert(layerSize > 0 && batchSize > 0);
+
+  EMatrix weights = EMatrix::Random(layerSize, layerSize);
+  EMatrix in = EMatrix::Random(layerSize, batchSize);
+  EMatrix out = EMatrix::Zero(layerSize, batchSize);
+  math::PackedMatrix packed = math::PackedMatrix::Pack(weights);
+
+  GemmReport result;
+  result.layerSize = layerSize;
+  result.batchSize = batchSize;
+
+  result.eigenForward = MicrosPerCall([&]() { out.noalias() += weights * in; });
+  result.kernelForward = MicrosPerCall([&]() { math::AddProduct(weights, in, out); });
+  result.packedForward = MicrosPerCall([&]() { math::AddProduct(packed, in, out); });
+
+  result.eigenBackward = MicrosPerCall([&]() { out.noalias() += weights.transpose() * in; });
+  result.kernelBackward = MicrosPerCall([&]() { math::AddProductTransA(weights, in, out); });
+  return result;
+}
+
+// Shapes that end in each partial step of the kernels, and odd inner dimensions.
+static constexpr unsigned CHECK_ROWS[] = {1, 2, 3, 4, 5, 8, 16, 17, 61};
+static constexpr unsigned CHECK_INNER[] = {1, 7, 33};
+static constexpr unsigned CHECK_MAX_BATCH = 17;
+// Dense weights, and weights pruned to a quarter of their blocks.
+static constexpr float CHECK_DENSITIES[] = {1.0f, 0.25f};
+
+float MaxGemmError(void) {
+  float result = 0.0f;
+  auto check = [&result](const EMatrix &expected, const EMatrix &actual) {
+    result = max(result, (expected - actual).cwiseAbs().maxCoeff());
+  };
+
+  for (float density : CHECK_DENSITIES) {
+    for (unsigned rows : CHECK_ROWS) {
+      for (unsigned inner : CHECK_INNER) {
+        EMatrix weights = EMatrix::Random(rows, inner);
+        math::BlockMask mask = math::LargestBlocks(weights, density);
+        math::ApplyBlockMask(mask, weights);
+        math::PackedMatrix packed = math::PackedMatrix::Pack(weights);
+
+        for (unsigned batchSize = 1; batchSize <= CHECK_MAX_BATCH; batchSize++) {
+          EMatrix in = EMatrix::Random(inner, batchSize);
+          EMatrix out = EMatrix::Random(rows, batchSize);
+          EMatrix expected = out + weights * in;
+
+          EMatrix actual = out;
+          math::AddProduct(weights, in, actual);
+          check(expected, actual);
+
+          actual = out;
+          math::AddProduct(packed, in, actual);
+          check(expected, actual);
+
+          actual = out;
+          math::AddProduct(weights, packed, in, actual);
+          check(expected, actual);
+
+          EMatrix transIn = EMatrix::Random(rows, batchSize);
+          EMatrix transOut = EMatrix::Random(inner, batchSize);
+          EMatrix transExpected = transOut + weights.transpose() * transIn;
+
+          actual = transOut;
+          math::AddProductTransA(weights, transIn, actual);
+          check(transExpected, actual);
+
+          actual = transOut;
+          math::AddProductTransA(packed, transIn, actual);
+          check(transExpected, actual);
+
+          actual = transOut;
+          math::AddProductTransA(weights, packed, transIn, actual);
+          check(transExpected, actual);
+
+          // Pruned blocks of the gradient are left as they were.
+          EMatrix gradient = EMatrix::Random(rows, inner);
+          EMatrix update = transIn * in.transpose();
+          math::ApplyBlockMask(mask, update);
+          actual = gradient;
+          math::AddProductTransB(transIn, in, packed, actual);
+          check(gradient + update, actual);
+        }
+      }
+    }
+  }
+  return result;
+}
+
+ostream &operator<<(ostream &stream, const GemmReport &report) {
+  stream << report.layerSize << "x" << report.layerSize << " weights, batch " << report.batchSize
+         << ": forward " << report.eigenForward << "us eigen, " << report.kernelForward
+         << "us kernel (" << report.eigenForward / report.kernelForward << "x), "
+         << report.packedForward << "us packed (" << report.eigenForward / report.packedForward
+         << "x); backward "
+         << report.eigenBackward << "us eigen, " << report.kernelBackward << "us kernel ("
+         << report.eigenBackward / report.kernelBackward << "x)";
+  return stream;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "common/Common.hpp"
+
+// Time per call of the products in a small-batch RNN step, with the kernels from
+// math/SmallGemm.hpp and with Eigen's general product, for a square layer of weights.
+struct GemmReport {
+  unsigned layerSize;
+  unsigned batchSize;
+
+  // Microseconds for weights * activations, the forward product, also with packed weights.
+  double eigenForward;
+  double kernelForward;
+  double packedForward;
+
+  // Microseconds for weights^T * deltas, the backward product.
+  double eigenBackward;
+  double kernelBackward;
+};
+
+GemmReport BenchmarkGemm(unsigned layerSize, unsigned batchSize);
+
+// The largest difference between each kernel's product and Eigen's, over every batch width up to
+// just past the kernels' limit and row counts that end in each size of partial step, for dense and
+// block pruned weights.
+float MaxGemmError(void);
+
+ostream &operator<<(ostream &stream, const GemmReport &report);
@@ -0,0 +1,103 @@
+#include "InferenceReport.hpp"
+#include "CharacterStream.hpp"
+#include "common/Benchmark.hpp"
+#include "neuralnetwork/rnn/InferenceModel.hpp"
+#include "neuralnetwork/rnn/InferenceSession.hpp"
+#include "neuralnetwork/rnn/RNN.hpp"
+
+#include <cassert>
+#include <cstdlib>
+
+using namespace neuralnetwork;
+using namespace neuralnetwork::rnn;
+
+// A whole prompt takes long enough that a few runs give a stable fastest time.
+static constexpr unsigned PREFILL_TRIALS = 5;
+
+static RNNSpec benchmarkSpec(unsigned hiddenSize) {
+  const unsigned numLetters = CharacterStream::Vocabulary().size();
+
+  RNNSpec spec;
+  spec.numInputs = numLetters;
+  spec.numOutputs = numLetters;
+  spec.hiddenActivation = LayerActivation::TANH;
+  spec.outputActivation = LayerActivation::SOFTMAX;
+  spec.nodeActivationRate = 1.0f;
+
+  spec.connections.emplace_back(0, 1, 0);
+  spec.connections.emplace_back(1, 2, 0);
+  spec.connections.emplace_back(2, 3, 0);
+  spec.connections.emplace_back(1, 1, 1);
+  spec.connections.emplace_back(2, 2, 1);
+
+  spec.layers.emplace_back(1, hiddenSize, false);
+  spec.layers.emplace_back(2, hiddenSize, false);
+  spec.layers.emplace_back(3, numLetters, true);
+  return spec;
+}
+
+QuantisedStepReport BenchmarkQuantisedStep(unsigned hiddenSize) {
+  assert(hiddenSize > 0);
+
+  RNN network(benchmarkSpec(hiddenSize));
+  InferenceModel model(network);
+  InferenceModel quantised = model.Quantised();
+
+  EMatrix input = EMatrix::Zero(model.spec.numInputs, 1);
+  input(0, 0) = 1.0f;
+  EVector temperatures = EVector::Ones(1);
+
+  InferenceSession floatSession(model, 1);
+  InferenceSession quantisedSession(quantised, 1);
+
+  QuantisedStepReport result;
+  result.hiddenSize = hiddenSize;
+  result.floatMicros = MicrosPerCall([&]() { floatSession.Step(input, temperatures); });
+  result.quantisedMicros = MicrosPerCall([&]() { quantisedSession.Step(input, temperatures); });
+  return result;
+}
+
+PrefillReport BenchmarkPrefill(unsigned hiddenSize, unsigned promptLength) {
+  assert(hiddenSize > 0 && promptLength > 0);
+
+  RNN network(benchmarkSpec(hiddenSize));
+  InferenceModel model(network);
+  InferenceSession session(model, 1);
+
+  EMatrix prompt = EMatrix::Zero(model.spec.numInputs, promptLength);
+  for (unsigned i = 0; i < promptLength; i++) {
+    prompt(rand() % prompt.rows(), i) = 1.0f;
+  }
+  EMatrix input(model.spec.numInputs, 1);
+  EVector temperatures = EVector::Ones(1);
+
+  PrefillReport result;
+  result.hiddenSize = hiddenSize;
+  result.promptLength = promptLength;
+  result.prefillMillis = MicrosPerCall([&]() {
+    session.Reset();
+    session.Prefill(0, prompt);
+  }, PREFILL_TRIALS, 1) / 1000.0;
+  result.stepMillis = MicrosPerCall([&]() {
+    session.Reset();
+    for (unsigned i = 0; i < promptLength; i++) {
+      input = prompt.col(i);
+      session.Step(input, temperatures);
+    }
+  }, PREFILL_TRIALS, 1) / 1000.0;
+  return result;
+}
+
+ostream &operator<<(ostream &stream, const QuantisedStepReport &report) {
+  stream << "2x" << report.hiddenSize << " step: " << report.floatMicros << "us fp32, "
+         << report.quantisedMicros << "us int8 (" << report.floatMicros / report.quantisedMicros
+         << "x)";
+  return stream;
+}
+
+ostream &operator<<(ostream &stream, const PrefillReport &report) {
+  stream << "2x" << report.hiddenSize << " prefill of " << report.promptLength << " letters: "
+         << report.prefillMillis << "ms, " << report.stepMillis << "ms with steps ("
+         << report.stepMillis / report.prefillMillis << "x)";
+  return stream;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "common/Common.hpp"
+
+// Time per call of InferenceSession paths, on a network of two self-recurrent tanh layers of the
+// given size between the letters in and out.
+
+// Microseconds per single-column Step, with the fp32 model and with its int8 copy.
+struct QuantisedStepReport {
+  unsigned hiddenSize;
+  double floatMicros;
+  double quantisedMicros;
+};
+
+QuantisedStepReport BenchmarkQuantisedStep(unsigned hiddenSize);
+
+// Milliseconds to feed a prompt of promptLength letters through one column with Prefill, and with
+// one Step per letter.
+struct PrefillReport {
+  unsigned hiddenSize;
+  unsigned promptLength;
+  double prefillMillis;
+  double stepMillis;
+};
+
+PrefillReport BenchmarkPrefill(unsigned hiddenSize, unsigned promptLength);
+
+ostream &operator<<(ostream &stream, const QuantisedStepReport &report);
+ostream &operator<<(ostream &stream, const PrefillReport &report);
@@ -0,0 +1,571 @@
+
+#include "InferenceServer.hpp"
+#include "CharacterStream.hpp"
+#include "math/Sampling.hpp"
+#include "neuralnetwork/rnn/InferenceSession.hpp"
+#include "neuralnetwork/rnn/PrefixStateCache.hpp"
+
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace neuralnetwork::rnn;
+
+typedef std::chrono::steady_clock Clock;
+
+static constexpr unsigned DEFAULT_LENGTH = 200;
+static constexpr float DEFAULT_TEMPERATURE = 0.7f;
+
+// Integer fields are at most this many digits, so that every accepted value fits an unsigned.
+static constexpr size_t MAX_COUNT_DIGITS = 9;
+
+// Prompt states are cached at every multiple of the stride and at the end of each prompt, so
+// prompts that only share a leading part still skip most of it.
+static constexpr size_t PREFIX_CACHE_BYTES = 64 * 1024 * 1024;
+static constexpr unsigned PREFIX_CACHE_STRIDE = 32;
+
+// Latency percentiles are taken over this many of the most recent requests.
+static constexpr unsigned MAX_LATENCY_SAMPLES = 10000;
+
+namespace {
+
+// Where the responses for one client go. Shared by the client's requests, so it outlives the
+// connection if generation is still running.
+struct ResponseSink {
+  virtual ~ResponseSink() = default;
+  virtual void WriteLine(const string &line) = 0;
+};
+
+struct StdoutSink : public ResponseSink {
+  std::mutex m;
+
+  void WriteLine(const string &line) override {
+    std::unique_lock<std::mutex> lock(m);
+    cout << line << '\n' << flush;
+  }
+};
+
+struct SocketSink : public ResponseSink {
+  int fd;
+  std::mutex m;
+
+  SocketSink(int fd) : fd(fd) {}
+  ~SocketSink() { close(fd); }
+
+  void WriteLine(const string &line) override {
+    std::unique_lock<std::mutex> lock(m);
+    string data = line + '\n';
+    // A client that went away just misses its output.
+    send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+  }
+};
+
+struct Request {
+  string id;
+  vector<unsigned> prompt;
+  unsigned length;
+  float temperature;
+  unsigned topK;
+  float topP;
+  unsigned seed;
+
+  sptr<ResponseSink> sink;
+  Clock::time_point arrival;
+};
+
+// A request occupying a column of the session.
+struct ActiveColumn {
+  bool active;
+  Request request;
+  std::mt19937 rng;
+
+  int nextInput; // vocabulary index fed at the next step, -1 for the all-zero start input.
+  unsigned promptPos;
+  unsigned generated;
+
+  ActiveColumn() : active(false), nextInput(-1), promptPos(0), generated(0) {}
+};
+
+// Parses a flat JSON object with string and number values.
+bool parseJsonObject(const string &line, map<string, string> &out) {
+  unsigned i = 0;
+  auto skipSpace = [&]() {
+    while (i < line.size() && isspace(static_cast<unsigned char>(line[i]))) {
+      i++;
+    }
+  };
+
+  auto parseString = [&](string &result) {
+    if (i >= line.size() || line[i] != '"') {
+      return false;
+    }
+    for (i++; i < line.size() && line[i] != '"'; i++) {
+      if (line[i] == '\\' && i + 1 < line.size()) {
+        i++;
+        char c = line[i];
+        if (c == 'u') {
+          if (i + 4 >= line.size() ||
+              !all_of(line.begin() + i + 1, line.begin() + i + 5,
+                      [](char h) { return isxdigit(static_cast<unsigned char>(h)) != 0; })) {
+            return false;
+          }
+
+          // Only single byte code points are kept, as that is all the vocabulary holds. NUL would
+          // end the text early for anything that reads it as a C string.
+          unsigned code = strtoul(line.substr(i + 1, 4).c_str(), nullptr, 16);
+          if (code == 0) {
+            return false;
+          }
+          result.push_back(code < 0x80 ? static_cast<char>(code) : '?');
+          i += 4;
+        } else {
+          result.push_back(c == 'n' ? '\n' : (c == 'r' ? '\r' : (c == 't' ? '\t' : c)));
+        }
+      } else {
+        result.push_back(line[i]);
+      }
+    }
+    if (i >= line.size()) {
+      return false;
+    }
+    i++;
+    return true;
+  };
+
+  skipSpace();
+  if (i >= line.size() || line[i++] != '{') {
+    return false;
+  }
+
+  skipSpace();
+  if (i < line.size() && line[i] == '}') {
+    return true;
+  }
+
+  while (true) {
+    skipSpace();
+    string key, value;
+    if (!parseString(key)) {
+      return false;
+    }
+
+    skipSpace();
+    if (i >= line.size() || line[i++] != ':') {
+      return false;
+    }
+
+    skipSpace();
+    if (i < line.size() && line[i] == '"') {
+      if (!parseString(value)) {
+        return false;
+      }
+    } else {
+      while (i < line.size() && line[i] != ',' && line[i] != '}' &&
+             !isspace(static_cast<unsigned char>(line[i]))) {
+        value.push_back(line[i++]);
+      }
+    }
+    out[key] = value;
+
+    // Every member is followed by another one or the end of the object.
+    skipSpace();
+    if (i >= line.size()) {
+      return false;
+    }
+    char separator = line[i++];
+    if (separator == '}') {
+      return true;
+    }
+    if (separator != ',') {
+      return false;
+    }
+  }
+}
+
+string jsonString(const string &s) {
+  string result = "\"";
+  for (char c : s) {
+    if (c == '"' || c == '\\') {
+      result.push_back('\\');
+      result.push_back(c);
+    } else if (c == '\n') {
+      result += "\\n";
+    } else if (c == '\r') {
+      result += "\\r";
+    } else if (c == '\t') {
+      result += "\\t";
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      // Any other control character would break the one response per line framing.
+      char escaped[7];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+      result += escaped;
+    } else {
+      result.push_back(c);
+    }
+  }
+  return result + "\"";
+}
+
+// Reads a non-negative integer field, or the default if it is absent. Signs, fractions, other
+// characters and values that do not fit are rejected.
+bool parseCount(const map<string, string> &fields, const string &key, unsigned defaultValue,
+                unsigned &out) {
+  auto it = fields.find(key);
+  if (it == fields.end()) {
+    out = defaultValue;
+    return true;
+  }
+
+  const string &value = it->second;
+  auto isDigit = [](char c) { return isdigit(static_cast<unsigned char>(c)) != 0; };
+  if (value.empty() || value.size() > MAX_COUNT_DIGITS ||
+      !all_of(value.begin(), value.end(), isDigit)) {
+    return false;
+  }
+  out = stoul(value);
+  return true;
+}
+
+// Reads an optional real-valued field. Text that is not entirely a number is
+// rejected rather than read as 0.
+bool parseReal(const map<string, string> &fields, const string &key, float defaultValue,
+               float &out) {
+  auto it = fields.find(key);
+  if (it == fields.end()) {
+    out = defaultValue;
+    return true;
+  }
+
+  const char *begin = it->second.c_str();
+  char *end = nullptr;
+  out = strtof(begin, &end);
+  return end != begin && *end == '\0';
+}
+}
+
+struct InferenceServer::InferenceServerImpl {
+  const InferenceModel &model;
+  const vector<char> vocabulary;
+  const unsigned maxBatchSize;
+
+  std::mutex m;
+  std::condition_variable cv;
+  std::deque<Request> pending;
+  bool inputClosed;
+
+  // Only touched by the generator thread.
+  PrefixStateCache prefixCache;
+  ColumnState cachedState;
+  math::SamplingScratch samplingScratch;
+
+  // Counters, guarded by m.
+  Clock::time_point startTime;
+  unsigned long long totalRequests;
+  unsigned long long totalChars;
+  unsigned long long cachedPromptChars;
+  std::deque<double> latenciesMs;
+
+  InferenceServerImpl(const InferenceModel &model, const vector<char> &vocabulary,
+                      unsigned maxBatchSize)
+      : model(model), vocabulary(vocabulary), maxBatchSize(maxBatchSize), inputClosed(false),
+        prefixCache(PREFIX_CACHE_BYTES), startTime(Clock::now()), totalRequests(0),
+        totalChars(0), cachedPromptChars(0) {
+    assert(maxBatchSize > 0);
+    assert(vocabulary.size() == model.spec.numInputs);
+    assert(vocabulary.size() == model.spec.numOutputs);
+  }
+
+  void ServeStdin(void) {
+    std::thread generator([this]() { this->generateLoop(); });
+
+    sptr<ResponseSink> sink = make_shared<StdoutSink>();
+    string line;
+    while (getline(cin, line)) {
+      handleLine(line, sink);
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(m);
+      inputClosed = true;
+    }
+    cv.notify_one();
+    generator.join();
+
+    std::unique_lock<std::mutex> lock(m);
+    cerr << statsLine() << endl;
+  }
+
+  void ServeUnixSocket(const string &path) {
+    int listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    assert(listenFd >= 0);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+
+    unlink(path.c_str());
+    if (bind(listenFd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) != 0 ||
+        listen(listenFd, 16) != 0) {
+      cerr << "failed to listen on " << path << endl;
+      close(listenFd);
+      return;
+    }
+
+    std::thread generator([this]() { this->generateLoop(); });
+    generator.detach();
+
+    while (true) {
+      int clientFd = accept(listenFd, nullptr, nullptr);
+      if (clientFd < 0) {
+        continue;
+      }
+
+      std::thread([this, clientFd]() { this->readClient(clientFd); }).detach();
+    }
+  }
+
+  void readClient(int fd) {
+    sptr<ResponseSink> sink = make_shared<SocketSink>(fd);
+
+    string buffer;
+    char chunk[4096];
+    while (true) {
+      ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+      if (n <= 0) {
+        break;
+      }
+
+      buffer.append(chunk, n);
+      size_t newline;
+      while ((newline = buffer.find('\n')) != string::npos) {
+        handleLine(buffer.substr(0, newline), sink);
+        buffer.erase(0, newline + 1);
+      }
+    }
+  }
+
+  void handleLine(const string &line, const sptr<ResponseSink> &sink) {
+    if (line.find_first_not_of(" \t\r") == string::npos) {
+      return;
+    }
+
+    map<string, string> fields;
+    if (!parseJsonObject(line, fields)) {
+      sink->WriteLine("{\"error\": \"malformed request\"}");
+      return;
+    }
+
+    if (fields["command"] == "stats") {
+      std::unique_lock<std::mutex> lock(m);
+      sink->WriteLine(statsLine());
+      return;
+    }
+
+    Request request;
+    request.id = fields["id"];
+    request.prompt = CharacterStream::Encode(fields["prompt"]);
+    request.sink = sink;
+    request.arrival = Clock::now();
+
+    if (!parseCount(fields, "length", DEFAULT_LENGTH, request.length)) {
+      sink->WriteLine("{\"id\": " + jsonString(request.id) +
+                      ", \"error\": \"length must be a non-negative integer\"}");
+      return;
+    }
+
+    if (!parseCount(fields, "seed", rand(), request.seed)) {
+      sink->WriteLine("{\"id\": " + jsonString(request.id) +
+                      ", \"error\": \"seed must be a non-negative integer\"}");
+      return;
+    }
+
+    if (!parseCount(fields, "top_k", 0, request.topK)) {
+      sink->WriteLine("{\"id\": " + jsonString(request.id) +
+                      ", \"error\": \"top_k must be a non-negative integer\"}");
+      return;
+    }
+
+    if (!parseReal(fields, "temperature", DEFAULT_TEMPERATURE, request.temperature) ||
+        !(request.temperature > 0.0f) || !std::isfinite(request.temperature)) {
+      sink->WriteLine("{\"id\": " + jsonString(request.id) +
+                      ", \"error\": \"temperature must be positive\"}");
+      return;
+    }
+
+    if (!parseReal(fields, "top_p", 1.0f, request.topP) ||
+        !(request.topP > 0.0f && request.topP <= 1.0f)) {
+      sink->WriteLine("{\"id\": " + jsonString(request.id) +
+                      ", \"error\": \"top_p must be in (0, 1]\"}");
+      return;
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(m);
+      pending.push_back(request);
+    }
+    cv.notify_one();
+  }
+
+  void generateLoop(void) {
+    InferenceSession session(model, maxBatchSize);
+    vector<ActiveColumn> columns(maxBatchSize);
+    unsigned numActive = 0;
+
+    EMatrix input(model.spec.numInputs, maxBatchSize);
+
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(m);
+        cv.wait(lock, [&]() { return numActive > 0 || !pending.empty() || inputClosed; });
+        if (numActive == 0 && pending.empty() && inputClosed) {
+          return;
+        }
+
+        for (unsigned c = 0; c < maxBatchSize && !pending.empty(); c++) {
+          if (!columns[c].active) {
+            admit(columns[c], c, std::move(pending.front()), session);
+            pending.pop_front();
+            numActive++;
+          }
+        }
+      }
+
+      input.fill(0.0f);
+      for (unsigned c = 0; c < maxBatchSize; c++) {
+        if (columns[c].active && columns[c].nextInput >= 0) {
+          input(columns[c].nextInput, c) = 1.0f;
+        }
+      }
+
+      const EMatrix &logits = session.StepLogits(input);
+
+      for (unsigned c = 0; c < maxBatchSize; c++) {
+        if (columns[c].active && advance(columns[c], c, session, logits.col(c))) {
+          columns[c].active = false;
+          numActive--;
+        }
+      }
+    }
+  }
+
+  // Expects m to be held.
+  void admit(ActiveColumn &column, unsigned index, Request &&request, InferenceSession &session) {
+    column.active = true;
+    column.rng.seed(request.seed);
+    column.generated = 0;
+    column.request = std::move(request);
+
+    const vector<unsigned> &prompt = column.request.prompt;
+
+    // The last prompt character always has to be fed, its output is the first sample.
+    unsigned cachedLength;
+    if (!prompt.empty() &&
+        prefixCache.Lookup(prompt, prompt.size() - 1, cachedLength, cachedState)) {
+      session.LoadColumn(index, cachedState);
+      column.nextInput = prompt[cachedLength];
+      column.promptPos = cachedLength + 1;
+      cachedPromptChars += cachedLength;
+    } else {
+      session.ResetColumn(index);
+      column.nextInput = -1;
+      column.promptPos = 0;
+    }
+  }
+
+  // Consumes the column's output for this step. Returns true once the request is complete.
+  bool advance(ActiveColumn &column, unsigned index, InferenceSession &session,
+               const Eigen::Ref<const EVector> &logits) {
+    Request &request = column.request;
+
+    // While the prompt is being consumed the outputs are not needed. The column state is now the
+    // state after the first promptPos prompt characters.
+    if (column.promptPos < request.prompt.size()) {
+      if (column.promptPos + 1 == request.prompt.size() ||
+          column.promptPos % PREFIX_CACHE_STRIDE == 0) {
+        session.SaveColumn(index, cachedState);
+        prefixCache.Insert(request.prompt, column.promptPos, cachedState);
+      }
+
+      column.nextInput = request.prompt[column.promptPos++];
+      return false;
+    }
+
+    if (column.generated < request.length) {
+      math::SamplingConfig config(request.temperature, request.topK, request.topP);
+      unsigned sample = math::SampleLogits(logits, config, column.rng, samplingScratch);
+      column.nextInput = sample;
+      column.generated++;
+
+      request.sink->WriteLine("{\"id\": " + jsonString(request.id) +
+                              ", \"text\": " + jsonString(string(1, vocabulary[sample])) + "}");
+    }
+
+    if (column.generated < request.length) {
+      return false;
+    }
+
+    double latencyMs =
+        std::chrono::duration<double, std::milli>(Clock::now() - request.arrival).count();
+
+    std::ostringstream done;
+    done << "{\"id\": " << jsonString(request.id) << ", \"done\": true, \"chars\": "
+         << column.generated << ", \"latency_ms\": " << latencyMs << "}";
+    request.sink->WriteLine(done.str());
+
+    std::unique_lock<std::mutex> lock(m);
+    totalRequests++;
+    totalChars += column.generated;
+    latenciesMs.push_back(latencyMs);
+    if (latenciesMs.size() > MAX_LATENCY_SAMPLES) {
+      latenciesMs.pop_front();
+    }
+    request.sink.reset();
+    return true;
+  }
+
+  // Expects m to be held.
+  string statsLine(void) {
+    double elapsed = std::chrono::duration<double>(Clock::now() - startTime).count();
+
+    vector<double> sorted(latenciesMs.begin(), latenciesMs.end());
+    sort(sorted.begin(), sorted.end());
+    auto percentile = [&sorted](double p) {
+      // nearest rank, so small samples still report their tail.
+      return sorted.empty() ? 0.0 : sorted[static_cast<unsigned>(ceil(p * sorted.size())) - 1];
+    };
+
+    std::ostringstream result;
+    result << "{\"requests\": " << totalRequests << ", \"chars\": " << totalChars
+           << ", \"chars_per_sec\": " << (elapsed > 0.0 ? totalChars / elapsed : 0.0)
+           << ", \"p50_ms\": " << percentile(0.5) << ", \"p99_ms\": " << percentile(0.99)
+           << ", \"cached_prompt_chars\": " << cachedPromptChars
+           << ", \"pending\": " << pending.size() << "}";
+    return result.str();
+  }
+};
+
+InferenceServer::InferenceServer(const InferenceModel &model, const vector<char> &vocabulary,
+                                 unsigned maxBatchSize)
+    : impl(new InferenceServerImpl(model, vocabulary, maxBatchSize)) {}
+
+InferenceServer::~InferenceServer() = default;
+
+void InferenceServer::ServeStdin(void) { impl->ServeStdin(); }
+
+void InferenceServer::ServeUnixSocket(const string &path) { impl->ServeUnixSocket(path); }
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "common/Common.hpp"
+#include "neuralnetwork/rnn/InferenceModel.hpp"
+#include <vector>
+
+// A long running generation service around one loaded model.
+//
+// Requests are JSON lines such as
+//   {"id": "a", "prompt": "to be or", "length": 200, "temperature": 0.7, "seed": 3}
+// (optionally with "top_k" and "top_p") and {"command": "stats"}. Every active request occupies
+// one column of a shared inference session, so all of them advance together in a single batched
+// step. New requests join as soon as a column is free (continuous batching). Prompt states are
+// kept in a PrefixStateCache, so a prompt sharing a prefix with an earlier one resumes from the
+// cached state. Each generated character is streamed back as
+//   {"id": "a", "text": "x"}
+// followed by {"id": "a", "done": true, "chars": 200, "latency_ms": 12.5} when finished.
+class InferenceServer {
+public:
+  InferenceServer(const neuralnetwork::rnn::InferenceModel &model, const vector<char> &vocabulary,
+                  unsigned maxBatchSize);
+  ~InferenceServer();
+
+  // Reads requests from stdin and writes responses to stdout. Returns once stdin is closed and
+  // every accepted request has finished.
+  void ServeStdin(void);
+
+  // Accepts any number of clients on a Unix domain socket. Does not return.
+  void ServeUnixSocket(const string &path);
+
+private:
+  struct InferenceServerImpl;
+  uptr<InferenceServerImpl> impl;
+};
@@ -0,0 +1,127 @@
+
+#include "ModelExport.hpp"
+#include "runtime/ModelFormat.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+using namespace neuralnetwork;
+using namespace neuralnetwork::rnn;
+
+static uint64_t alignUp(uint64_t offset) {
+  return (offset + runtime::MODEL_ALIGNMENT - 1) / runtime::MODEL_ALIGNMENT *
+         runtime::MODEL_ALIGNMENT;
+}
+
+static runtime::Activation exportedActivation(LayerActivation activation) {
+  switch (activation) {
+  case LayerActivation::TANH:
+    return runtime::Activation::TANH;
+  case LayerActivation::LOGISTIC:
+    return runtime::Activation::LOGISTIC;
+  case LayerActivation::RELU:
+    return runtime::Activation::RELU;
+  case LayerActivation::LEAKY_RELU:
+    return runtime::Activation::LEAKY_RELU;
+  case LayerActivation::ELU:
+    return runtime::Activation::ELU;
+  case LayerActivation::LINEAR:
+    return runtime::Activation::LINEAR;
+  case LayerActivation::SOFTMAX:
+    return runtime::Activation::SOFTMAX;
+  }
+  assert(false);
+  return runtime::Activation::LINEAR;
+}
+
+bool ExportModel(const string &path, const InferenceModel &model, const vector<char> &vocabulary) {
+  assert(vocabulary.size() == model.spec.numInputs);
+
+  runtime::ModelHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, runtime::MODEL_MAGIC, sizeof(header.magic));
+  header.version = runtime::MODEL_VERSION;
+  header.numInputs = model.spec.numInputs;
+  header.numOutputs = model.spec.numOutputs;
+  header.vocabularySize = vocabulary.size();
+  header.numLayers = model.layers.size();
+
+  vector<runtime::ModelLayer> layers;
+  vector<runtime::ModelConnection> connections;
+  vector<const InferenceConnection *> sources;
+
+  for (const auto &layer : model.layers) {
+    layers.push_back(runtime::ModelLayer{
+        layer.numNodes, static_cast<uint32_t>(exportedActivation(layer.activation)),
+        layer.isOutput ? 1u : 0u, layer.isRecurrentSource ? 1u : 0u,
+        static_cast<uint32_t>(connections.size()), static_cast<uint32_t>(layer.incoming.size())});
+
+    for (const auto &connection : layer.incoming) {
+      assert(!connection.isQuantised);
+      connections.push_back(runtime::ModelConnection{
+          connection.srcIndex, static_cast<uint32_t>(connection.connection.timeOffset),
+          static_cast<uint32_t>(connection.weights.rows()),
+          static_cast<uint32_t>(connection.weights.cols()), 0, 0});
+      sources.push_back(&connection);
+    }
+  }
+  header.numConnections = connections.size();
+
+  uint64_t offset = sizeof(header);
+  header.vocabularyOffset = offset;
+  offset = alignUp(offset + vocabulary.size());
+  header.layersOffset = offset;
+  offset = alignUp(offset + layers.size() * sizeof(runtime::ModelLayer));
+  header.connectionsOffset = offset;
+  offset += connections.size() * sizeof(runtime::ModelConnection);
+
+  for (auto &connection : connections) {
+    offset = alignUp(offset);
+    connection.weightsOffset = offset;
+    uint64_t weightBytes = static_cast<uint64_t>(connection.rows) * connection.cols * sizeof(float);
+    offset = alignUp(offset + weightBytes);
+    connection.biasOffset = offset;
+    offset += connection.rows * sizeof(float);
+  }
+  header.fileSize = offset;
+
+  string tmpPath = path + ".tmp";
+  std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    return false;
+  }
+
+  static const char zeros[runtime::MODEL_ALIGNMENT] = {0};
+  auto padTo = [&out](uint64_t target) {
+    uint64_t pos = out.tellp();
+    assert(pos <= target && target - pos < runtime::MODEL_ALIGNMENT);
+    out.write(zeros, target - pos);
+  };
+
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(vocabulary.data(), vocabulary.size());
+  padTo(header.layersOffset);
+  out.write(reinterpret_cast<const char *>(layers.data()),
+            layers.size() * sizeof(runtime::ModelLayer));
+  padTo(header.connectionsOffset);
+  out.write(reinterpret_cast<const char *>(connections.data()),
+            connections.size() * sizeof(runtime::ModelConnection));
+
+  for (unsigned i = 0; i < connections.size(); i++) {
+    const ERowMatrix &rowMajor = sources[i]->weights;
+    padTo(connections[i].weightsOffset);
+    out.write(reinterpret_cast<const char *>(rowMajor.data()), rowMajor.size() * sizeof(float));
+    padTo(connections[i].biasOffset);
+    out.write(reinterpret_cast<const char *>(sources[i]->bias.data()),
+              sources[i]->bias.size() * sizeof(float));
+  }
+
+  out.close();
+  if (!out) {
+    remove(tmpPath.c_str());
+    return false;
+  }
+
+  return rename(tmpPath.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "common/Common.hpp"
+#include "neuralnetwork/rnn/InferenceModel.hpp"
+#include <vector>
+
+// Writes a model and the vocabulary its inputs and outputs index into as a single file for the
+// standalone runtime (see runtime/ModelFormat.hpp). Only float models can be exported.
+bool ExportModel(const string &path, const neuralnetwork::rnn::InferenceModel &model,
+                 const vector<char> &vocabulary);
@@ -0,0 +1,129 @@
+
+#include "NGramCache.hpp"
+#include <cassert>
+
+// Number of consecutive slots a key may occupy.
+static constexpr unsigned PROBE_LENGTH = 4;
+
+namespace {
+
+struct Slot {
+  uint64_t key;
+  bool valid;
+  bool pinned;
+
+  Slot() : key(0), valid(false), pinned(false) {}
+};
+}
+
+struct NGramCache::NGramCacheImpl {
+  unsigned capacity; // a power of two.
+  vector<Slot> slots;
+  EMatrix distributions; // column i holds slot i's distribution.
+
+  unsigned numEntries;
+  unsigned nextVictim;
+
+  NGramCacheImpl(unsigned minCapacity, unsigned outputDim) : numEntries(0), nextVictim(0) {
+    assert(minCapacity > 0 && outputDim > 0);
+
+    capacity = PROBE_LENGTH;
+    while (capacity < minCapacity) {
+      capacity *= 2;
+    }
+
+    slots.resize(capacity);
+    distributions.resize(outputDim, capacity);
+  }
+
+  bool Lookup(uint64_t key, EVector &out) {
+    int slot = find(key);
+    if (slot < 0) {
+      return false;
+    }
+
+    out = distributions.col(slot);
+    return true;
+  }
+
+  void Insert(uint64_t key, const Eigen::Ref<const EVector> &distribution, bool pinned) {
+    assert(distribution.rows() == distributions.rows());
+
+    int slot = find(key);
+    if (slot < 0) {
+      slot = freeSlot(key);
+      if (slot < 0) {
+        return; // every candidate slot is pinned.
+      }
+    }
+
+    if (!slots[slot].valid) {
+      numEntries++;
+    }
+
+    slots[slot].key = key;
+    slots[slot].valid = true;
+    slots[slot].pinned = slots[slot].pinned || pinned;
+    distributions.col(slot) = distribution;
+  }
+
+  void Clear(void) {
+    for (auto &slot : slots) {
+      slot = Slot();
+    }
+    numEntries = 0;
+  }
+
+  unsigned home(uint64_t key) const {
+    return static_cast<unsigned>((key * 0x9E3779B97F4A7C15ull) >> 32) & (capacity - 1);
+  }
+
+  int find(uint64_t key) const {
+    unsigned start = home(key);
+    for (unsigned i = 0; i < PROBE_LENGTH; i++) {
+      unsigned slot = (start + i) & (capacity - 1);
+      if (slots[slot].valid && slots[slot].key == key) {
+        return slot;
+      }
+    }
+    return -1;
+  }
+
+  // An empty slot for the key if there is one, otherwise an unpinned one taken in rotation.
+  int freeSlot(uint64_t key) {
+    unsigned start = home(key);
+    for (unsigned i = 0; i < PROBE_LENGTH; i++) {
+      unsigned slot = (start + i) & (capacity - 1);
+      if (!slots[slot].valid) {
+        return slot;
+      }
+    }
+
+    for (unsigned i = 0; i < PROBE_LENGTH; i++) {
+      unsigned slot = (start + (nextVictim + i) % PROBE_LENGTH) & (capacity - 1);
+      if (!slots[slot].pinned) {
+        nextVictim++;
+        return slot;
+      }
+    }
+    return -1;
+  }
+};
+
+NGramCache::NGramCache(unsigned capacity, unsigned outputDim)
+    : impl(new NGramCacheImpl(capacity, outputDim)) {}
+
+NGramCache::~NGramCache() = default;
+
+bool NGramCache::Lookup(uint64_t key, EVector &out) { return impl->Lookup(key, out); }
+
+void NGramCache::Insert(uint64_t key, const Eigen::Ref<const EVector> &distribution,
+                        bool pinned) {
+  impl->Insert(key, distribution, pinned);
+}
+
+void NGramCache::Clear(void) { impl->Clear(); }
+
+unsigned NGramCache::Capacity(void) const { return impl->capacity; }
+
+unsigned NGramCache::NumEntries(void) const { return impl->numEntries; }
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "common/Common.hpp"
+#include "math/Math.hpp"
+#include <cstdint>
+
+// A fixed-capacity table of network output distributions keyed by packed n-gram context. A key
+// may sit in any of a few slots after its hash, and a miss takes the place of an entry in them
+// that is not pinned. Not thread safe.
+class NGramCache {
+public:
+  NGramCache(unsigned capacity, unsigned outputDim);
+  ~NGramCache();
+
+  // On a hit, copies the key's distribution into out and returns true.
+  bool Lookup(uint64_t key, EVector &out);
+
+  // Pinned entries are never replaced by later inserts, only by Clear.
+  void Insert(uint64_t key, const Eigen::Ref<const EVector> &distribution, bool pinned);
+
+  void Clear(void);
+
+  unsigned Capacity(void) const;
+  unsigned NumEntries(void) const;
+
+private:
+  // Non-copyable
+  NGramCache(const NGramCache &other) = delete;
+  NGramCache &operator=(const NGramCache &) = delete;
+
+  struct NGramCacheImpl;
+  uptr<NGramCacheImpl> impl;
+};
@@ -0,0 +1,91 @@
+
+#include "PerplexityReport.hpp"
+#include "neuralnetwork/rnn/InferenceSession.hpp"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <cassert>
+#include <chrono>
+#include <cmath>
+
+using namespace neuralnetwork::rnn;
+
+// Every piece loses its first prediction and starts without context, so there are few of them,
+// but enough to give each thread a full batch.
+static constexpr unsigned EVAL_PIECES = 256;
+static constexpr unsigned EVAL_BATCH_SIZE = 32;
+
+static double groupLogLoss(const InferenceModel &model, const vector<math::OneHotVector> &heldOut,
+                           unsigned firstPiece, unsigned numPieces, unsigned pieceLength) {
+  InferenceSession session(model, numPieces);
+  EVector temperatures = EVector::Ones(numPieces);
+  EMatrix input(model.spec.numInputs, numPieces);
+
+  auto charAt = [&](unsigned piece, unsigned t) {
+    return heldOut[(firstPiece + piece) * pieceLength + t].index;
+  };
+
+  double result = 0.0;
+  for (unsigned t = 0; t + 1 < pieceLength; t++) {
+    input.fill(0.0f);
+    for (unsigned c = 0; c < numPieces; c++) {
+      input(charAt(c, t), c) = 1.0f;
+    }
+
+    const EMatrix &pChars = session.Step(input, temperatures);
+    for (unsigned c = 0; c < numPieces; c++) {
+      result -= log(max(pChars(charAt(c, t + 1), c), 1e-30f));
+    }
+  }
+
+  return result;
+}
+
+PerplexityReport EvaluatePerplexity(const InferenceModel &model,
+                                    const vector<math::OneHotVector> &heldOut) {
+  assert(heldOut.size() >= 2);
+  auto start = std::chrono::steady_clock::now();
+
+  const unsigned numPieces = min<unsigned>(EVAL_PIECES, heldOut.size() / 2);
+  const unsigned pieceLength = heldOut.size() / numPieces;
+  const unsigned numGroups = (numPieces + EVAL_BATCH_SIZE - 1) / EVAL_BATCH_SIZE;
+
+  // Summed in group order afterwards, so the floating point result is repeatable.
+  vector<double> groupLoss(numGroups, 0.0);
+  tbb::parallel_for(tbb::blocked_range<unsigned>(0, numGroups, 1),
+                    [&](const tbb::blocked_range<unsigned> &r) {
+                      for (unsigned g = r.begin(); g != r.end(); g++) {
+                        unsigned first = g * EVAL_BATCH_SIZE;
+                        unsigned count = min(EVAL_BATCH_SIZE, numPieces - first);
+                        groupLoss[g] = groupLogLoss(model, heldOut, first, count, pieceLength);
+                      }
+                    });
+
+  double totalLoss = 0.0;
+  for (double loss : groupLoss) {
+    totalLoss += loss;
+  }
+
+  PerplexityReport result;
+  result.numPredictions = numPieces * (pieceLength - 1);
+  result.logLoss = totalLoss / result.numPredictions;
+  result.seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+double PerplexityReport::BitsPerChar(void) const { return logLoss / log(2.0); }
+
+double PerplexityReport::Perplexity(void) const { return exp(logLoss); }
+
+double PerplexityReport::CharsPerSecond(void) const {
+  return seconds > 0.0 ? numPredictions / seconds : 0.0;
+}
+
+ostream &operator<<(ostream &stream, const PerplexityReport &report) {
+  stream << "held-out " << report.BitsPerChar() << " bits/char (perplexity "
+         << report.Perplexity() << ") over " << report.numPredictions << " chars, "
+         << report.CharsPerSecond() << " chars/sec";
+  return stream;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common/Common.hpp"
+#include "math/OneHotVector.hpp"
+#include "neuralnetwork/rnn/InferenceModel.hpp"
+#include <vector>
+
+// How well a model predicts held-out text, and how quickly it was measured.
+struct PerplexityReport {
+  unsigned numPredictions;
+  double logLoss; // mean negative log likelihood per character, in nats.
+  double seconds;
+
+  double BitsPerChar(void) const;
+  double Perplexity(void) const;
+  double CharsPerSecond(void) const;
+};
+
+// The held-out text is cut into contiguous pieces that each start from a fresh state. Groups of
+// pieces form the columns of one batched inference session, and the groups are evaluated in
+// parallel. The piece layout does not depend on the number of threads, so neither does the result.
+PerplexityReport EvaluatePerplexity(const neuralnetwork::rnn::InferenceModel &model,
+                                    const vector<math::OneHotVector> &heldOut);
+
+ostream &operator<<(ostream &stream, const PerplexityReport &report);
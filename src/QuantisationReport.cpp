@@ -0,0 +1,27 @@
+
+#include "QuantisationReport.hpp"
+#include "PerplexityReport.hpp"
+#include <cassert>
+
+using namespace neuralnetwork::rnn;
+
+QuantisationReport CompareQuantisation(const InferenceModel &exact,
+                                       const InferenceModel &quantised,
+                                       const vector<math::OneHotVector> &heldOut) {
+  assert(heldOut.size() >= 2);
+
+  PerplexityReport exactReport = EvaluatePerplexity(exact, heldOut);
+  PerplexityReport quantisedReport = EvaluatePerplexity(quantised, heldOut);
+
+  QuantisationReport result;
+  result.numPredictions = exactReport.numPredictions;
+  result.exactLogLoss = exactReport.logLoss;
+  result.quantisedLogLoss = quantisedReport.logLoss;
+  return result;
+}
+
+ostream &operator<<(ostream &stream, const QuantisationReport &report) {
+  stream << "log-loss over " << report.numPredictions << " chars: fp32 " << report.exactLogLoss
+         << ", int8 " << report.quantisedLogLoss << " (delta " << report.LogLossDelta() << ")";
+  return stream;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "common/Common.hpp"
+#include "math/OneHotVector.hpp"
+#include "neuralnetwork/rnn/InferenceModel.hpp"
+#include <vector>
+
+// How much predictive accuracy int8 quantisation costs, measured on held-out text.
+struct QuantisationReport {
+  unsigned numPredictions;
+
+  // Mean negative log likelihood per character, in nats.
+  double exactLogLoss;
+  double quantisedLogLoss;
+
+  double LogLossDelta(void) const { return quantisedLogLoss - exactLogLoss; }
+};
+
+QuantisationReport CompareQuantisation(const neuralnetwork::rnn::InferenceModel &exact,
+                                       const neuralnetwork::rnn::InferenceModel &quantised,
+                                       const vector<math::OneHotVector> &heldOut);
+
+ostream &operator<<(ostream &stream, const QuantisationReport &report);
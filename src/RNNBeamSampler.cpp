@@ -1,4 +1,6 @@
 #include "RNNBeamSampler.hpp"
+#include "math/Sampling.hpp"
+#include "neuralnetwork/rnn/InferenceSession.hpp"
 #include <algorithm>
 #include <cassert>
 
@@ -6,77 +8,121 @@ static constexpr unsigned NUM_BEAMS = 100;
 static constexpr unsigned RESAMPLE_RATE = 10;
 static constexpr unsigned RESAMPLE_DROP = 30;
 
+// The sample histories of all beams form a tree, each node pointing to the character before it.
+// Resampling a beam then only copies a node index rather than the whole history.
+struct SampleNode {
+  unsigned sample;
+  int parent; // -1 for the first character of a beam.
+
+  SampleNode(unsigned sample, int parent) : sample(sample), parent(parent) {}
+};
+
+// A beam is a single column of a shared inference session, it holds no weights of its own.
 struct SampledBeam {
-  neuralnetwork::rnn::RNN rnn;
+  float logProbabilitySum;
+  int lastNode; // -1 before the first sample.
+
+  SampledBeam() : logProbabilitySum(0.0), lastNode(-1) {}
+};
+
+struct RNNBeamSampler::RNNBeamSamplerImpl {
   unsigned letterDim;
+  std::mt19937 rng;
+  math::SamplingScratch scratch;
 
-  float logProbabilitySum;
-  vector<unsigned> samples;
+  RNNBeamSamplerImpl(unsigned letterDim) : letterDim(letterDim) { assert(letterDim > 0); }
+
+  vector<unsigned> SampleCharacters(neuralnetwork::rnn::RNN *network, unsigned numChars) {
+    neuralnetwork::rnn::InferenceModel model(*network);
+    neuralnetwork::rnn::InferenceSession session(model, NUM_BEAMS);
+    rng.seed(rand());
 
-  SampledBeam(const neuralnetwork::rnn::RNN &rnn, unsigned letterDim)
-      : rnn(rnn), letterDim(letterDim), logProbabilitySum(0.0) {}
+    vector<SampledBeam> beams(NUM_BEAMS);
+    vector<SampleNode> nodes;
+    nodes.reserve(NUM_BEAMS * numChars);
 
-  void Sample(void) {
-    EVector input(letterDim);
+    // Column i holds the one-hot encoding of the last character sampled by beam i.
+    EMatrix input(letterDim, NUM_BEAMS);
     input.fill(0.0f);
 
-    if (samples.size() > 0) {
-      input(samples.back()) = 1.0f;
-    }
+    for (unsigned i = 0; i < numChars; i++) {
+      const EMatrix &logits = session.StepLogits(input);
+
+      for (unsigned j = 0; j < NUM_BEAMS; j++) {
+        sample(logits.col(j), beams[j], nodes);
 
-    EVector pChar = rnn.Process(input, 1.0);
-    float r = math::UnitRand();
+        input.col(j).fill(0.0f);
+        input(nodes[beams[j].lastNode].sample, j) = 1.0f;
+      }
 
-    for (int i = 0; i < pChar.rows(); i++) {
-      r -= pChar(i);
-      if (r < 0.0f) {
-        logProbabilitySum += logf(pChar(i));
-        samples.push_back(i);
-        return;
+      if (i % RESAMPLE_RATE == 0) {
+        resample(session, beams, input);
       }
     }
 
-    unsigned index = rand() % pChar.rows();
-    logProbabilitySum += logf(pChar(index));
-    samples.push_back(index);
+    auto order = sortedOrder(beams);
+    const SampledBeam &worst = beams[order.front()];
+    const SampledBeam &best = beams[order.back()];
+
+    cout << worst.logProbabilitySum << " : " << best.logProbabilitySum << endl;
+    return history(best, nodes);
   }
-};
 
-struct RNNBeamSampler::RNNBeamSamplerImpl {
-  unsigned letterDim;
+  void sample(const Eigen::Ref<const EVector> &logits, SampledBeam &beam,
+              vector<SampleNode> &nodes) {
+    unsigned index = math::SampleLogits(logits, math::SamplingConfig(1.0f), rng, scratch);
 
-  RNNBeamSamplerImpl(unsigned letterDim) : letterDim(letterDim) { assert(letterDim > 0); }
+    beam.logProbabilitySum += math::LogSoftmax(logits, index);
+    nodes.emplace_back(index, beam.lastNode);
+    beam.lastNode = nodes.size() - 1;
+  }
 
-  vector<unsigned> SampleCharacters(neuralnetwork::rnn::RNN *network, unsigned numChars) {
-    network->ClearMemory();
+  // Replaces the RESAMPLE_DROP least likely beams with copies of randomly chosen survivors. Only
+  // the recurrent state columns and the history node indices are copied.
+  void resample(neuralnetwork::rnn::InferenceSession &session, vector<SampledBeam> &beams,
+                EMatrix &input) {
+    vector<unsigned> order = sortedOrder(beams);
 
-    vector<SampledBeam> beams;
-    for (unsigned i = 0; i < NUM_BEAMS; i++) {
-      beams.emplace_back(*network, letterDim);
+    vector<unsigned> sourceColumns(order);
+    for (unsigned j = 0; j < RESAMPLE_DROP; j++) {
+      sourceColumns[j] = order[RESAMPLE_DROP + (rng() % (NUM_BEAMS - RESAMPLE_DROP))];
     }
 
-    for (unsigned i = 0; i < numChars; i++) {
-      for (auto &beam : beams) {
-        beam.Sample();
-      }
+    vector<SampledBeam> resampled;
+    resampled.reserve(beams.size());
 
-      if (i % RESAMPLE_RATE == 0) {
-        sort(beams.begin(), beams.end(), [](const SampledBeam &a, const SampledBeam &b) {
-          return a.logProbabilitySum < b.logProbabilitySum;
-        });
+    EMatrix resampledInput(input.rows(), input.cols());
+    for (unsigned j = 0; j < sourceColumns.size(); j++) {
+      resampled.push_back(beams[sourceColumns[j]]);
+      resampledInput.col(j) = input.col(sourceColumns[j]);
+    }
 
-        for (unsigned j = 0; j < RESAMPLE_DROP; j++) {
-          beams[j] = beams[RESAMPLE_DROP + (rand() % (NUM_BEAMS - RESAMPLE_DROP))];
-        }
-      }
+    beams.swap(resampled);
+    input.swap(resampledInput);
+    session.ReorderColumns(sourceColumns);
+  }
+
+  // Beam indices in order of increasing log probability.
+  vector<unsigned> sortedOrder(const vector<SampledBeam> &beams) {
+    vector<unsigned> result(beams.size());
+    for (unsigned i = 0; i < result.size(); i++) {
+      result[i] = i;
     }
 
-    sort(beams.begin(), beams.end(), [](const SampledBeam &a, const SampledBeam &b) {
-      return a.logProbabilitySum < b.logProbabilitySum;
+    sort(result.begin(), result.end(), [&beams](unsigned a, unsigned b) {
+      return beams[a].logProbabilitySum < beams[b].logProbabilitySum;
     });
+    return result;
+  }
+
+  vector<unsigned> history(const SampledBeam &beam, const vector<SampleNode> &nodes) {
+    vector<unsigned> result;
+    for (int node = beam.lastNode; node >= 0; node = nodes[node].parent) {
+      result.push_back(nodes[node].sample);
+    }
 
-    cout << beams.front().logProbabilitySum << " : " << beams.back().logProbabilitySum << endl;
-    return beams.back().samples;
+    reverse(result.begin(), result.end());
+    return result;
   }
 };
 
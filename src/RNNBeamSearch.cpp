@@ -0,0 +1,174 @@
+#include "RNNBeamSearch.hpp"
+#include "neuralnetwork/rnn/InferenceSession.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace neuralnetwork::rnn;
+
+namespace {
+
+struct SearchNode {
+  unsigned sample;
+  int parent; // -1 for the first character of the completion.
+
+  SearchNode(unsigned sample, int parent) : sample(sample), parent(parent) {}
+};
+
+struct Hypothesis {
+  float logProbability;
+  int lastNode;
+  unsigned length;
+};
+
+struct Candidate {
+  float logProbability;
+  unsigned beam;
+  unsigned sample;
+
+  bool operator>(const Candidate &other) const { return logProbability > other.logProbability; }
+};
+}
+
+struct RNNBeamSearch::RNNBeamSearchImpl {
+  unsigned letterDim;
+  Config config;
+
+  RNNBeamSearchImpl(unsigned letterDim, const Config &config)
+      : letterDim(letterDim), config(config) {
+    assert(letterDim > 0);
+    assert(config.beamWidth > 0);
+  }
+
+  vector<unsigned> Complete(const InferenceModel &model, const vector<unsigned> &prefix) {
+    assert(model.spec.numInputs == letterDim && model.spec.numOutputs == letterDim);
+    const unsigned width = config.beamWidth;
+
+    InferenceSession session(model, width);
+    EVector temperatures = EVector::Ones(width);
+    EMatrix input(letterDim, width);
+    input.fill(0.0f);
+
+    // Every column consumes the prefix, the last prefix character is fed by the first search step.
+    for (unsigned i = 0; i + 1 < prefix.size(); i++) {
+      session.Step(setInput(input, prefix[i]), temperatures);
+    }
+    if (!prefix.empty()) {
+      setInput(input, prefix.back());
+    }
+
+    vector<SearchNode> nodes;
+    vector<Hypothesis> finished;
+
+    // Initially only column 0 is live, the other columns would only produce duplicates.
+    vector<Hypothesis> beams{Hypothesis{0.0f, -1, 0}};
+
+    vector<Candidate> heap;
+    heap.reserve(width + 1);
+    vector<unsigned> sourceColumns(width, 0);
+
+    EMatrix logP(letterDim, width);
+    for (unsigned step = 0; step < config.maxChars && !beams.empty(); step++) {
+      logP = session.Step(input, temperatures).array().log();
+
+      // Min-heap of the best width candidates across all beams x characters. Anything no better
+      // than the current worst survivor is rejected without touching the heap.
+      heap.clear();
+      for (unsigned b = 0; b < beams.size(); b++) {
+        for (unsigned c = 0; c < letterDim; c++) {
+          Candidate candidate{beams[b].logProbability + logP(c, b), b, c};
+          if (heap.size() == width && !(candidate > heap.front())) {
+            continue;
+          }
+
+          heap.push_back(candidate);
+          push_heap(heap.begin(), heap.end(), greater<Candidate>());
+          if (heap.size() > width) {
+            pop_heap(heap.begin(), heap.end(), greater<Candidate>());
+            heap.pop_back();
+          }
+        }
+      }
+
+      sort_heap(heap.begin(), heap.end(), greater<Candidate>()); // best first.
+
+      vector<Hypothesis> next;
+      for (const auto &candidate : heap) {
+        const Hypothesis &parent = beams[candidate.beam];
+        nodes.emplace_back(candidate.sample, parent.lastNode);
+
+        Hypothesis h{candidate.logProbability, static_cast<int>(nodes.size() - 1),
+                     parent.length + 1};
+        if (isEndChar(candidate.sample)) {
+          finished.push_back(h);
+        } else {
+          sourceColumns[next.size()] = candidate.beam;
+          next.push_back(h);
+        }
+      }
+
+      beams.swap(next);
+      if (finished.size() >= width) {
+        break;
+      }
+
+      // Unused columns keep whatever state they are given, their outputs are never read.
+      for (unsigned j = beams.size(); j < width; j++) {
+        sourceColumns[j] = 0;
+      }
+      session.ReorderColumns(sourceColumns);
+
+      input.fill(0.0f);
+      for (unsigned j = 0; j < beams.size(); j++) {
+        input(nodes[beams[j].lastNode].sample, j) = 1.0f;
+      }
+    }
+
+    // Hypotheses still running at maxChars compete with the finished ones.
+    finished.insert(finished.end(), beams.begin(), beams.end());
+    if (finished.empty()) {
+      return vector<unsigned>();
+    }
+
+    auto best = max_element(finished.begin(), finished.end(),
+                            [this](const Hypothesis &a, const Hypothesis &b) {
+                              return normalisedScore(a) < normalisedScore(b);
+                            });
+    return history(*best, nodes);
+  }
+
+  const EMatrix &setInput(EMatrix &input, unsigned sample) {
+    assert(sample < letterDim);
+    input.fill(0.0f);
+    input.row(sample).fill(1.0f);
+    return input;
+  }
+
+  bool isEndChar(unsigned sample) const {
+    return find(config.endChars.begin(), config.endChars.end(), sample) != config.endChars.end();
+  }
+
+  float normalisedScore(const Hypothesis &h) const {
+    return h.logProbability / powf((5.0f + h.length) / 6.0f, config.lengthPenalty);
+  }
+
+  vector<unsigned> history(const Hypothesis &h, const vector<SearchNode> &nodes) const {
+    vector<unsigned> result;
+    for (int node = h.lastNode; node >= 0; node = nodes[node].parent) {
+      result.push_back(nodes[node].sample);
+    }
+
+    reverse(result.begin(), result.end());
+    return result;
+  }
+};
+
+RNNBeamSearch::RNNBeamSearch(unsigned letterDim, const Config &config)
+    : impl(new RNNBeamSearchImpl(letterDim, config)) {}
+
+RNNBeamSearch::~RNNBeamSearch() = default;
+
+vector<unsigned> RNNBeamSearch::Complete(const InferenceModel &model,
+                                         const vector<unsigned> &prefix) {
+  return impl->Complete(model, prefix);
+}
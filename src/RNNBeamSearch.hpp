@@ -0,0 +1,32 @@
+#pragma once
+
+#include "common/Common.hpp"
+#include "neuralnetwork/rnn/InferenceModel.hpp"
+#include <vector>
+
+// Deterministic beam search: keeps the beamWidth most likely continuations at every step.
+class RNNBeamSearch {
+public:
+  struct Config {
+    unsigned beamWidth;
+    unsigned maxChars;
+
+    // Scores of finished hypotheses are divided by ((5 + length) / 6)^lengthPenalty, so 0 ranks
+    // by raw log probability and larger values favour longer completions.
+    float lengthPenalty;
+
+    // A hypothesis is finished once it emits one of these characters.
+    vector<unsigned> endChars;
+  };
+
+  RNNBeamSearch(unsigned letterDim, const Config &config);
+  ~RNNBeamSearch();
+
+  // Returns the best completion of the prefix, not including the prefix itself.
+  vector<unsigned> Complete(const neuralnetwork::rnn::InferenceModel &model,
+                            const vector<unsigned> &prefix);
+
+private:
+  struct RNNBeamSearchImpl;
+  uptr<RNNBeamSearchImpl> impl;
+};
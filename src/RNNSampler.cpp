@@ -1,43 +1,78 @@
 #include "RNNSampler.hpp"
+#include "neuralnetwork/rnn/InferenceSession.hpp"
 #include <cassert>
+#include <random>
+
+static constexpr float DEFAULT_TEMPERATURE = 0.7f;
 
 struct RNNSampler::RNNSamplerImpl {
   unsigned letterDim;
 
   RNNSamplerImpl(unsigned letterDim) : letterDim(letterDim) { assert(letterDim > 0); }
 
-  vector<unsigned> SampleCharacters(neuralnetwork::rnn::RNN *network, unsigned numChars) {
-    vector<unsigned> result;
-    result.reserve(numChars);
+  vector<unsigned> SampleCharacters(neuralnetwork::rnn::RNN *network,
+                                    const vector<unsigned> &prompt, unsigned numChars) {
+    vector<Stream> streams{Stream(DEFAULT_TEMPERATURE, rand())};
+    return SampleCharacters(network, prompt, numChars, streams).front();
+  }
 
-    network->ClearMemory();
-    for (unsigned i = 0; i < numChars; i++) {
-      unsigned sample = sampleChar(network, result);
-      result.push_back(sample);
-    }
+  vector<vector<unsigned>> SampleCharacters(neuralnetwork::rnn::RNN *network,
+                                            const vector<unsigned> &prompt, unsigned numChars,
+                                            const vector<Stream> &streams) {
+    assert(!streams.empty());
 
-    return result;
-  }
+    vector<vector<unsigned>> result(streams.size());
+    vector<math::SamplingConfig> configs;
+    vector<std::mt19937> rngs;
 
-  unsigned sampleChar(neuralnetwork::rnn::RNN *rnn, const vector<unsigned> &prevChars) {
-    EVector input(letterDim);
+    for (unsigned i = 0; i < streams.size(); i++) {
+      result[i].reserve(numChars);
+      configs.push_back(streams[i].sampling);
+      rngs.emplace_back(streams[i].seed);
+    }
+
+    // One column per stream, holding the one-hot encoding of that stream's previous character.
+    EMatrix input(letterDim, streams.size());
     input.fill(0.0f);
 
-    if (prevChars.size() > 0) {
-      input(prevChars.back()) = 1.0f;
+    neuralnetwork::rnn::InferenceModel model(*network);
+    neuralnetwork::rnn::InferenceSession session(model, streams.size());
+
+    if (!prompt.empty()) {
+      // The start input and all but the last prompt character are prefilled into the first column
+      // and copied to the rest. The last character is the first input of the sampling loop.
+      EMatrix promptInputs(letterDim, prompt.size());
+      promptInputs.fill(0.0f);
+      for (unsigned i = 0; i + 1 < prompt.size(); i++) {
+        assert(prompt[i] < letterDim);
+        promptInputs(prompt[i], i + 1) = 1.0f;
+      }
+      session.Prefill(0, promptInputs);
+
+      neuralnetwork::rnn::ColumnState state;
+      session.SaveColumn(0, state);
+      for (unsigned j = 1; j < streams.size(); j++) {
+        session.LoadColumn(j, state);
+      }
+
+      assert(prompt.back() < letterDim);
+      input.row(prompt.back()).fill(1.0f);
     }
 
-    EVector pChar = rnn->Process(input, 0.7);
-    float r = math::UnitRand();
+    math::SamplingScratch scratch;
+    vector<unsigned> samples;
+
+    for (unsigned i = 0; i < numChars; i++) {
+      math::SampleLogits(session.StepLogits(input), configs, rngs, samples, scratch);
 
-    for (int i = 0; i < pChar.rows(); i++) {
-      r -= pChar(i);
-      if (r < 0.0f) {
-        return static_cast<unsigned>(i);
+      input.fill(0.0f);
+      for (unsigned j = 0; j < streams.size(); j++) {
+        result[j].push_back(samples[j]);
+        input(samples[j], j) = 1.0f;
       }
     }
 
-    return static_cast<unsigned>(rand() % pChar.rows());
+    return result;
   }
 };
 
@@ -46,5 +81,23 @@ RNNSampler::RNNSampler(unsigned letterDim) : impl(new RNNSamplerImpl(letterDim))
 RNNSampler::~RNNSampler() = default;
 
 vector<unsigned> RNNSampler::SampleCharacters(neuralnetwork::rnn::RNN *network, unsigned numChars) {
-  return impl->SampleCharacters(network, numChars);
+  return impl->SampleCharacters(network, vector<unsigned>(), numChars);
+}
+
+vector<vector<unsigned>> RNNSampler::SampleCharacters(neuralnetwork::rnn::RNN *network,
+                                                      unsigned numChars,
+                                                      const vector<Stream> &streams) {
+  return impl->SampleCharacters(network, vector<unsigned>(), numChars, streams);
+}
+
+vector<unsigned> RNNSampler::SampleCharacters(neuralnetwork::rnn::RNN *network,
+                                              const vector<unsigned> &prompt, unsigned numChars) {
+  return impl->SampleCharacters(network, prompt, numChars);
+}
+
+vector<vector<unsigned>> RNNSampler::SampleCharacters(neuralnetwork::rnn::RNN *network,
+                                                      const vector<unsigned> &prompt,
+                                                      unsigned numChars,
+                                                      const vector<Stream> &streams) {
+  return impl->SampleCharacters(network, prompt, numChars, streams);
 }
@@ -1,16 +1,39 @@
 #pragma once
 
 #include "common/Common.hpp"
+#include "math/Sampling.hpp"
 #include "neuralnetwork/rnn/RNN.hpp"
 #include <vector>
 
 class RNNSampler {
 public:
+  // An independently sampled sequence with its own sampling settings and random seed.
+  struct Stream {
+    math::SamplingConfig sampling;
+    unsigned seed;
+
+    Stream(float temperature, unsigned seed) : sampling(temperature), seed(seed) {}
+    Stream(const math::SamplingConfig &sampling, unsigned seed) : sampling(sampling), seed(seed) {}
+  };
+
   RNNSampler(unsigned letterDim);
   ~RNNSampler();
 
   vector<unsigned> SampleCharacters(neuralnetwork::rnn::RNN *network, unsigned numChars);
 
+  // Generates one sequence per stream. All streams advance together as the columns of a single
+  // batched network step.
+  vector<vector<unsigned>> SampleCharacters(neuralnetwork::rnn::RNN *network, unsigned numChars,
+                                            const vector<Stream> &streams);
+
+  // As above, but every stream continues on from the given prompt (vocabulary indices). The prompt
+  // is read once with InferenceSession::Prefill and its state shared by all streams.
+  vector<unsigned> SampleCharacters(neuralnetwork::rnn::RNN *network,
+                                    const vector<unsigned> &prompt, unsigned numChars);
+  vector<vector<unsigned>> SampleCharacters(neuralnetwork::rnn::RNN *network,
+                                            const vector<unsigned> &prompt, unsigned numChars,
+                                            const vector<Stream> &streams);
+
 private:
   struct RNNSamplerImpl;
   uptr<RNNSamplerImpl> impl;
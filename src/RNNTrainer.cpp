@@ -1,6 +1,9 @@
 
 #include "RNNTrainer.hpp"
 #include "AdamGradient.hpp"
+#include "Checkpoint.hpp"
+#include "PerplexityReport.hpp"
+#include "neuralnetwork/rnn/InferenceModel.hpp"
 
 #include <tbb/blocked_range.h>
 #include <tbb/parallel_for.h>
@@ -19,20 +22,74 @@ using namespace neuralnetwork::rnn;
 
 static constexpr unsigned TRAINING_SIZE = 100 * 1000 * 1000;
 static constexpr unsigned BATCH_SIZE = 16;
+static constexpr unsigned PRUNE_INTERVAL = 100;
+
+// Evaluation never takes more than this fraction of the text away from training.
+static constexpr float MAX_HELD_OUT_FRACTION = 0.1f;
 
 struct RNNTrainer::RNNTrainerImpl {
   unsigned traceLength;
   AdamGradient gradientPolicy;
 
-  RNNTrainerImpl(unsigned traceLength) : traceLength(traceLength) {}
+  string checkpointPath;
+  unsigned checkpointInterval;
+  unsigned activationCheckpointInterval;
+
+  unsigned heldOutChars;
+  unsigned evaluationInterval;
+
+  float finalDensity;
+  unsigned pruneStartIter;
+  unsigned pruneEndIter;
+
+  RNNTrainerImpl(unsigned traceLength)
+      : traceLength(traceLength), checkpointInterval(0), activationCheckpointInterval(0),
+        heldOutChars(0), evaluationInterval(0), finalDensity(1.0f), pruneStartIter(0),
+        pruneEndIter(0) {}
+
+  void EnableCheckpointing(const string &path, unsigned interval) {
+    assert(interval > 0);
+    checkpointPath = path;
+    checkpointInterval = interval;
+  }
+
+  void EnableActivationCheckpointing(unsigned interval) { activationCheckpointInterval = interval; }
+
+  void EnableEvaluation(unsigned heldOutChars, unsigned interval) {
+    assert(heldOutChars >= 2 && interval > 0);
+    this->heldOutChars = heldOutChars;
+    this->evaluationInterval = interval;
+  }
+
+  void EnablePruning(float density, unsigned startIter, unsigned endIter) {
+    assert(density > 0.0f && density <= 1.0f);
+    assert(startIter < endIter);
+    finalDensity = density;
+    pruneStartIter = startIter;
+    pruneEndIter = endIter;
+  }
 
   uptr<RNN> TrainLanguageNetwork(CharacterStream &cStream, unsigned iters) {
     const unsigned numSubsets = tbb::task_scheduler_init::default_num_threads();
 
     uptr<RNN> network = createNewNetwork(cStream.VectorDimension(), cStream.VectorDimension());
 
+    unsigned startIter = 0;
+    uptr<CheckpointWriter> checkpointWriter;
+    if (checkpointInterval > 0) {
+      startIter = resumeFromCheckpoint(network);
+      checkpointWriter = make_unique<CheckpointWriter>(checkpointPath);
+    }
+
     vector<math::OneHotVector> letters = cStream.ReadCharacters(TRAINING_SIZE);
-    for (unsigned i = 0; i < iters; i++) {
+
+    vector<math::OneHotVector> heldOut;
+    if (evaluationInterval > 0) {
+      heldOut = holdOut(letters);
+    }
+    assert(letters.size() > traceLength);
+
+    for (unsigned i = startIter; i < iters; i++) {
       if (i % 100 == 0) {
         cout << i << "/" << iters << endl;
       }
@@ -45,7 +102,7 @@ struct RNNTrainer::RNNTrainerImpl {
                              &gradientMutex](const tbb::blocked_range<unsigned> &r) {
 
         vector<SliceBatch> batch = this->makeBatch(letters, BATCH_SIZE / numSubsets);
-        math::Tensor gradient = net->ComputeGradient(batch);
+        math::Tensor gradient = net->ComputeGradient(batch, this->activationCheckpointInterval);
 
         {
           std::unique_lock<std::mutex> lock(gradientMutex);
@@ -56,22 +113,84 @@ struct RNNTrainer::RNNTrainerImpl {
       tbb::parallel_for(tbb::blocked_range<unsigned>(0, numSubsets), gradientWorker);
       assert(gradients.size() > 0);
 
-      math::Tensor gradient = gradients[0];
-      for (unsigned j = 1; j < gradients.size(); j++) {
-        gradient += gradients[j];
-      }
-      gradient *= 1.0f / gradients.size();
+      math::Tensor gradient = math::Tensor::Mean(move(gradients));
 
       // vector<SliceBatch> batch = this->makeBatch(letters, BATCH_SIZE);
-      // math::Tensor gradient = network->ComputeGradient(batch);
+      // math::Tensor gradient = network->ComputeGradient(batch, activationCheckpointInterval);
 
-      gradient = gradientPolicy.UpdateGradient(gradient);
+      gradientPolicy.UpdateGradientInPlace(gradient);
       network->UpdateWeights(gradient);
+
+      if (isPruningIter(i + 1)) {
+        network->PruneRecurrent(pruningDensity(i + 1));
+      }
+
+      if (checkpointWriter != nullptr && ((i + 1) % checkpointInterval == 0 || i + 1 == iters)) {
+        checkpointWriter->Write(makeCheckpoint(*network, i + 1));
+      }
+
+      if (!heldOut.empty() && ((i + 1) % evaluationInterval == 0 || i + 1 == iters)) {
+        cout << i + 1 << ": " << EvaluatePerplexity(InferenceModel(*network), heldOut) << endl;
+      }
     }
 
     return move(network);
   }
 
+  // Moves the characters to evaluate on from the end of letters. A short text gives up fewer of
+  // them than asked for, or none if too few are left to evaluate on.
+  vector<math::OneHotVector> holdOut(vector<math::OneHotVector> &letters) const {
+    unsigned size = min<unsigned>(heldOutChars, letters.size() * MAX_HELD_OUT_FRACTION);
+    if (size < 2) {
+      cout << "text too short to hold out for evaluation, skipping it" << endl;
+      return vector<math::OneHotVector>();
+    }
+    if (size < heldOutChars) {
+      cout << "holding out " << size << " of the requested " << heldOutChars << " characters"
+           << endl;
+    }
+
+    vector<math::OneHotVector> result(letters.end() - size, letters.end());
+    letters.erase(letters.end() - size, letters.end());
+    return result;
+  }
+
+  bool isPruningIter(unsigned iter) const {
+    if (finalDensity >= 1.0f || iter < pruneStartIter || iter > pruneEndIter) {
+      return false;
+    }
+    return (iter - pruneStartIter) % PRUNE_INTERVAL == 0 || iter == pruneEndIter;
+  }
+
+  float pruningDensity(unsigned iter) const {
+    float remaining = static_cast<float>(pruneEndIter - iter) / (pruneEndIter - pruneStartIter);
+    return finalDensity + (1.0f - finalDensity) * remaining * remaining * remaining;
+  }
+
+  // Returns the iteration to continue training from.
+  unsigned resumeFromCheckpoint(uptr<RNN> &network) {
+    Maybe<Checkpoint> checkpoint = ReadCheckpoint(checkpointPath);
+    if (!checkpoint.valid()) {
+      return 0;
+    }
+
+    network = make_unique<RNN>(checkpoint.val().spec);
+    network->SetWeights(checkpoint.val().weights);
+    gradientPolicy.SetState(checkpoint.val().optimiser);
+
+    cout << "resuming from checkpoint at iteration " << checkpoint.val().iteration << endl;
+    return checkpoint.val().iteration;
+  }
+
+  Checkpoint makeCheckpoint(const RNN &network, unsigned iteration) {
+    Checkpoint result;
+    result.iteration = iteration;
+    result.spec = network.GetSpec();
+    result.weights = network.GetWeights();
+    result.optimiser = gradientPolicy.GetState();
+    return result;
+  }
+
   vector<SliceBatch> makeBatch(const vector<math::OneHotVector> &trainingData, unsigned batchSize) {
     assert(trainingData.size() > traceLength);
 
@@ -164,6 +283,22 @@ RNNTrainer::RNNTrainer(unsigned traceLength) : impl(new RNNTrainerImpl(traceLeng
 
 RNNTrainer::~RNNTrainer() = default;
 
+void RNNTrainer::EnableCheckpointing(const string &path, unsigned interval) {
+  impl->EnableCheckpointing(path, interval);
+}
+
+void RNNTrainer::EnableActivationCheckpointing(unsigned interval) {
+  impl->EnableActivationCheckpointing(interval);
+}
+
+void RNNTrainer::EnableEvaluation(unsigned heldOutChars, unsigned interval) {
+  impl->EnableEvaluation(heldOutChars, interval);
+}
+
+void RNNTrainer::EnablePruning(float density, unsigned startIter, unsigned endIter) {
+  impl->EnablePruning(density, startIter, endIter);
+}
+
 uptr<RNN> RNNTrainer::TrainLanguageNetwork(CharacterStream &cStream, unsigned iters) {
   return impl->TrainLanguageNetwork(cStream, iters);
 }
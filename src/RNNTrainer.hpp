@@ -9,6 +9,24 @@ public:
   RNNTrainer(unsigned miniTraceLength);
   ~RNNTrainer();
 
+  // Periodically snapshots the network and optimiser to the given path. If a checkpoint already
+  // exists there, training resumes from it.
+  void EnableCheckpointing(const string &path, unsigned interval);
+
+  // Keep only every interval-th time slice of a trace during backprop and recompute the rest.
+  // Roughly sqrt(trace length) gives the lowest memory use for long traces.
+  void EnableActivationCheckpointing(unsigned interval);
+
+  // Holds the last heldOutChars characters of the training text back from training, and every
+  // interval iterations reports the network's bits per character on them. At most a tenth of a
+  // short text is held out.
+  void EnableEvaluation(unsigned heldOutChars, unsigned interval);
+
+  // Prunes the recurrent weights a block at a time, by magnitude, from all of them kept at
+  // startIter down to the given fraction at endIter. The kept fraction follows a cubic schedule,
+  // so most blocks go early while the network can still adapt to losing them.
+  void EnablePruning(float density, unsigned startIter, unsigned endIter);
+
   uptr<neuralnetwork::rnn::RNN> TrainLanguageNetwork(CharacterStream &cStream, unsigned iters);
 
 private:
@@ -0,0 +1,85 @@
+#include "TranscendentalReport.hpp"
+#include "common/Benchmark.hpp"
+#include "math/Transcendentals.hpp"
+
+#include <cassert>
+#include <limits>
+#include <tuple>
+
+static constexpr unsigned SWEEP_SIZE = 1000 * 1000;
+
+// Evenly spaced points in [start, end].
+static EMatrix sweep(float start, float end) {
+  return Eigen::VectorXf::LinSpaced(SWEEP_SIZE, start, end);
+}
+
+// The largest difference between the fast and exact function over the inputs, relative to the
+// exact value if asked.
+template <typename F> static double maxError(F &&function, const EMatrix &inputs, bool relative) {
+  EMatrix exact = inputs;
+  math::SetTranscendentalMode(math::TranscendentalMode::EXACT);
+  function(exact);
+
+  EMatrix fast = inputs;
+  math::SetTranscendentalMode(math::TranscendentalMode::FAST);
+  function(fast);
+
+  EMatrix error = (fast - exact).cwiseAbs();
+  if (relative) {
+    error.array() /= exact.array().abs().max(numeric_limits<float>::min());
+  }
+  return error.maxCoeff();
+}
+
+template <typename F>
+static pair<double, double> exactAndFastMicros(F &&function, const EMatrix &inputs) {
+  EMatrix m = inputs;
+
+  math::SetTranscendentalMode(math::TranscendentalMode::EXACT);
+  double exact = MicrosPerCall([&]() {
+    m = inputs;
+    function(m);
+  });
+
+  math::SetTranscendentalMode(math::TranscendentalMode::FAST);
+  double fast = MicrosPerCall([&]() {
+    m = inputs;
+    function(m);
+  });
+
+  return make_pair(exact, fast);
+}
+
+TranscendentalReport BenchmarkTranscendentals(unsigned layerSize, unsigned batchSize) {
+  assert(layerSize > 0 && batchSize > 0);
+
+  const math::TranscendentalMode previousMode = math::GetTranscendentalMode();
+  auto applyExp = [](EMatrix &m) { math::Exp(m); };
+  auto applyTanh = [](EMatrix &m) { math::Tanh(m); };
+  auto applyLog = [](EMatrix &m) { math::Log(m); };
+
+  TranscendentalReport result;
+  result.expError = maxError(applyExp, sweep(-87.0f, 88.0f), true);
+  result.tanhError = maxError(applyTanh, sweep(-10.0f, 10.0f), false);
+  result.logError = maxError(applyLog, sweep(1e-3f, 10.0f), true);
+
+  EMatrix activations = EMatrix::Random(layerSize, batchSize) * 4.0f;
+  EMatrix positive = activations.cwiseAbs().array() + 1e-3f;
+
+  tie(result.exactExp, result.fastExp) = exactAndFastMicros(applyExp, activations);
+  tie(result.exactTanh, result.fastTanh) = exactAndFastMicros(applyTanh, activations);
+  tie(result.exactLog, result.fastLog) = exactAndFastMicros(applyLog, positive);
+
+  math::SetTranscendentalMode(previousMode);
+  return result;
+}
+
+ostream &operator<<(ostream &stream, const TranscendentalReport &report) {
+  stream << "exp: error " << report.expError << ", " << report.exactExp << "us exact, "
+         << report.fastExp << "us fast (" << report.exactExp / report.fastExp << "x)" << endl;
+  stream << "tanh: error " << report.tanhError << ", " << report.exactTanh << "us exact, "
+         << report.fastTanh << "us fast (" << report.exactTanh / report.fastTanh << "x)" << endl;
+  stream << "log: error " << report.logError << ", " << report.exactLog << "us exact, "
+         << report.fastLog << "us fast (" << report.exactLog / report.fastLog << "x)";
+  return stream;
+}
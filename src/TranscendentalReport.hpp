@@ -0,0 +1,22 @@
+#pragma once
+
+#include "common/Common.hpp"
+
+// The accuracy and speed of the fast transcendentals in math/Transcendentals.hpp compared with
+// the exact ones, on the shape of a layer's activations in a training step.
+struct TranscendentalReport {
+  // The largest error over a sweep of each function's useful range. It is relative for exp and
+  // log, and absolute for tanh.
+  double expError;
+  double tanhError;
+  double logError;
+
+  // Microseconds per call over a batch of activations, in exact and in fast mode.
+  double exactExp, fastExp;
+  double exactTanh, fastTanh;
+  double exactLog, fastLog;
+};
+
+TranscendentalReport BenchmarkTranscendentals(unsigned layerSize, unsigned batchSize);
+
+ostream &operator<<(ostream &stream, const TranscendentalReport &report);
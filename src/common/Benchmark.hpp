@@ -0,0 +1,23 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+
+// Microseconds per call of f, from the fastest of several trials of repeated calls. The fastest
+// trial is the one least disturbed by everything else running on the machine.
+template <typename F>
+double MicrosPerCall(F &&f, unsigned trials = 20, unsigned callsPerTrial = 50) {
+  double result = 0.0;
+  for (unsigned i = 0; i < trials; i++) {
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned j = 0; j < callsPerTrial; j++) {
+      f();
+    }
+    double micros =
+        std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start)
+            .count() /
+        callsPerTrial;
+    result = i == 0 ? micros : std::min(result, micros);
+  }
+  return result;
+}
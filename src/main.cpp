@@ -1,23 +1,70 @@
 
 #include "CharacterStream.hpp"
 #include "FFNetworkSampler.hpp"
+#include "Checkpoint.hpp"
+#include "FFNetworkReport.hpp"
 #include "FFNetworkTrainer.hpp"
+#include "GemmReport.hpp"
+#include "InferenceReport.hpp"
+#include "InferenceServer.hpp"
+#include "ModelExport.hpp"
+#include "QuantisationReport.hpp"
 #include "RNNBeamSampler.hpp"
+#include "RNNBeamSearch.hpp"
 #include "RNNSampler.hpp"
 #include "RNNTrainer.hpp"
+#include "TranscendentalReport.hpp"
 #include "common/Common.hpp"
 #include "common/Maybe.hpp"
+#include "math/Transcendentals.hpp"
+#include "neuralnetwork/rnn/InferenceModel.hpp"
 #include "neuralnetwork/rnn/RNN.hpp"
 
 static constexpr unsigned NGRAM_SIZE = 4;
+static constexpr auto FF_BACKEND = neuralnetwork::NetworkBackendType::CPU;
+static constexpr unsigned CHECKPOINT_INTERVAL = 10000;
+static constexpr unsigned TRACE_LENGTH = 24;
+// Backprop keeps one time slice in this many and recomputes the rest, trading time for memory on
+// long traces. About sqrt(TRACE_LENGTH) uses the least memory, and zero keeps every slice.
+static constexpr unsigned ACTIVATION_CHECKPOINT_INTERVAL = 5;
+static constexpr unsigned HELD_OUT_CHARS = 100000;
+static constexpr unsigned EVALUATION_INTERVAL = 10000;
+// The fraction of recurrent weight blocks kept by pruning, e.g. 0.25. 1 keeps them all and turns
+// pruning off.
+static constexpr float RECURRENT_DENSITY = 1.0f;
+static constexpr unsigned PRUNE_START_ITER = 500000;
+static constexpr unsigned PRUNE_END_ITER = 2500000;
+static constexpr unsigned SERVER_BATCH_SIZE = 64;
+static constexpr unsigned BEAM_WIDTH = 8;
+static constexpr unsigned BEAM_MAX_CHARS = 200;
+static constexpr float BEAM_LENGTH_PENALTY = 0.6f;
+static constexpr unsigned CONTEXT_CACHE_SIZE = 64 * 1024;
+static constexpr unsigned BENCHMARK_BATCH_SIZES[] = {4, 16};
+static constexpr unsigned BENCHMARK_LAYER_SIZES[] = {64, 128, 256};
+static constexpr float MAX_GEMM_ERROR = 1e-4f;
+static constexpr unsigned QUANTISED_BENCHMARK_SIZES[] = {128, 1024};
+static constexpr unsigned PREFILL_BENCHMARK_SIZES[] = {128, 512};
+static constexpr unsigned PREFILL_BENCHMARK_LENGTH = 2000;
+static constexpr unsigned FF_BENCHMARK_BATCH_SIZE = 500;
+static constexpr unsigned FF_BENCHMARK_CONTEXTS = 64;
+static constexpr unsigned COMPARISON_ITERS = 20000;
+static constexpr unsigned COMPARISON_EVALUATION_INTERVAL = 2000;
 
 void testFFNetwork(string path) {
   CharacterStream cstream(path);
 
-  FFNetworkTrainer trainer(NGRAM_SIZE);
+  FFNetworkTrainer trainer(NGRAM_SIZE, FF_BACKEND);
   auto network = trainer.TrainLanguageNetwork(cstream, 100000);
 
   FFNetworkSampler sampler(NGRAM_SIZE, cstream.VectorDimension());
+  sampler.EnableContextCache(CONTEXT_CACHE_SIZE);
+
+  // The most frequent contexts of the text after the training set are computed up front.
+  vector<unsigned> text;
+  for (const auto &letter : cstream.ReadCharacters(HELD_OUT_CHARS)) {
+    text.push_back(letter.index);
+  }
+  sampler.PrefetchContexts(network.get(), text, CONTEXT_CACHE_SIZE / 2);
   vector<unsigned> sampled = sampler.SampleCharacters(network.get(), 1000);
 
   for (const auto sample : sampled) {
@@ -27,12 +74,27 @@ void testFFNetwork(string path) {
   cout << endl;
 }
 
-void testRNN(string path) {
+void testRNN(string path, string checkpointPath) {
   CharacterStream cstream(path);
 
-  RNNTrainer trainer(24);
+  RNNTrainer trainer(TRACE_LENGTH);
+  if (!checkpointPath.empty()) {
+    trainer.EnableCheckpointing(checkpointPath, CHECKPOINT_INTERVAL);
+  }
+  trainer.EnableActivationCheckpointing(ACTIVATION_CHECKPOINT_INTERVAL);
+  trainer.EnableEvaluation(HELD_OUT_CHARS, EVALUATION_INTERVAL);
+  if (RECURRENT_DENSITY < 1.0f) {
+    trainer.EnablePruning(RECURRENT_DENSITY, PRUNE_START_ITER, PRUNE_END_ITER);
+  }
   auto network = trainer.TrainLanguageNetwork(cstream, 5000000);
 
+  // Whatever the trainer did not read is held out to check the int8 model's accuracy.
+  vector<math::OneHotVector> heldOut = cstream.ReadCharacters(HELD_OUT_CHARS);
+  if (heldOut.size() >= 2) {
+    neuralnetwork::rnn::InferenceModel model(*network);
+    cout << CompareQuantisation(model, model.Quantised(), heldOut) << endl;
+  }
+
   RNNSampler sampler(cstream.VectorDimension());
   // RNNBeamSampler sampler(cstream.VectorDimension());
   vector<unsigned> sampled = sampler.SampleCharacters(network.get(), 10000);
@@ -44,13 +106,162 @@ void testRNN(string path) {
   cout << endl;
 }
 
+// Loads a trained model from a checkpoint and serves generation requests, from stdin or from a
+// Unix socket if a path is given.
+int serve(string checkpointPath, string socketPath) {
+  Maybe<Checkpoint> checkpoint = ReadCheckpoint(checkpointPath);
+  if (!checkpoint.valid()) {
+    cerr << "could not read checkpoint: " << checkpointPath << endl;
+    return 1;
+  }
+
+  vector<char> vocabulary = CharacterStream::Vocabulary();
+  const auto &spec = checkpoint.val().spec;
+  if (spec.numInputs != vocabulary.size() || spec.numOutputs != vocabulary.size()) {
+    cerr << "checkpoint does not match the vocabulary: " << checkpointPath << endl;
+    return 1;
+  }
+
+  neuralnetwork::rnn::InferenceModel model(spec, checkpoint.val().weights);
+  InferenceServer server(model, vocabulary, SERVER_BATCH_SIZE);
+
+  if (socketPath.empty()) {
+    server.ServeStdin();
+  } else {
+    server.ServeUnixSocket(socketPath);
+  }
+  return 0;
+}
+
+// Completes a prompt with the most likely text a trained model gives it, up to the end of the
+// sentence.
+int complete(string checkpointPath, string prompt) {
+  Maybe<Checkpoint> checkpoint = ReadCheckpoint(checkpointPath);
+  if (!checkpoint.valid()) {
+    cerr << "could not read checkpoint: " << checkpointPath << endl;
+    return 1;
+  }
+
+  vector<char> vocabulary = CharacterStream::Vocabulary();
+  const auto &spec = checkpoint.val().spec;
+  if (spec.numInputs != vocabulary.size() || spec.numOutputs != vocabulary.size()) {
+    cerr << "checkpoint does not match the vocabulary: " << checkpointPath << endl;
+    return 1;
+  }
+
+  neuralnetwork::rnn::InferenceModel model(spec, checkpoint.val().weights);
+
+  RNNBeamSearch::Config config;
+  config.beamWidth = BEAM_WIDTH;
+  config.maxChars = BEAM_MAX_CHARS;
+  config.lengthPenalty = BEAM_LENGTH_PENALTY;
+  config.endChars = CharacterStream::Encode(".");
+
+  RNNBeamSearch search(vocabulary.size(), config);
+  vector<unsigned> completion = search.Complete(model, CharacterStream::Encode(prompt));
+
+  cout << prompt;
+  for (unsigned sample : completion) {
+    cout << vocabulary[sample];
+  }
+  cout << endl;
+  return 0;
+}
+
+// Writes the model in a checkpoint as a standalone file for the runtime/ sampler.
+int exportModel(string checkpointPath, string modelPath) {
+  Maybe<Checkpoint> checkpoint = ReadCheckpoint(checkpointPath);
+  if (!checkpoint.valid()) {
+    cerr << "could not read checkpoint: " << checkpointPath << endl;
+    return 1;
+  }
+
+  vector<char> vocabulary = CharacterStream::Vocabulary();
+  const auto &spec = checkpoint.val().spec;
+  if (spec.numInputs != vocabulary.size() || spec.numOutputs != vocabulary.size()) {
+    cerr << "checkpoint does not match the vocabulary: " << checkpointPath << endl;
+    return 1;
+  }
+
+  neuralnetwork::rnn::InferenceModel model(spec, checkpoint.val().weights);
+  if (!ExportModel(modelPath, model, vocabulary)) {
+    cerr << "could not write model: " << modelPath << endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Compares the small-batch matrix kernels used in RNN training with Eigen's general product, and
+// times the faster inference and training paths against the plain ones.
+int benchmark(void) {
+  float gemmError = MaxGemmError();
+  cout << "kernel products differ from eigen by at most " << gemmError << endl;
+  if (gemmError > MAX_GEMM_ERROR) {
+    return 1;
+  }
+
+  for (unsigned batchSize : BENCHMARK_BATCH_SIZES) {
+    for (unsigned layerSize : BENCHMARK_LAYER_SIZES) {
+      cout << BenchmarkGemm(layerSize, batchSize) << endl;
+    }
+  }
+
+  for (unsigned hiddenSize : QUANTISED_BENCHMARK_SIZES) {
+    cout << BenchmarkQuantisedStep(hiddenSize) << endl;
+  }
+  for (unsigned hiddenSize : PREFILL_BENCHMARK_SIZES) {
+    cout << BenchmarkPrefill(hiddenSize, PREFILL_BENCHMARK_LENGTH) << endl;
+  }
+  cout << BenchmarkSparseTraining(NGRAM_SIZE, FF_BENCHMARK_BATCH_SIZE, FF_BACKEND) << endl;
+  cout << BenchmarkSparseInference(NGRAM_SIZE, FF_BENCHMARK_CONTEXTS, FF_BACKEND) << endl;
+  return 0;
+}
+
+// Measures the fast transcendentals, then trains the same network from the same seed with exact
+// and with fast ones, reporting both held-out loss curves.
+int compareTranscendentals(string path) {
+  cout << BenchmarkTranscendentals(BENCHMARK_LAYER_SIZES[1], BENCHMARK_BATCH_SIZES[1]) << endl;
+
+  const math::TranscendentalMode modes[] = {math::TranscendentalMode::EXACT,
+                                            math::TranscendentalMode::FAST};
+  for (auto mode : modes) {
+    cout << (mode == math::TranscendentalMode::FAST ? "fast" : "exact") << " transcendentals"
+         << endl;
+    math::SetTranscendentalMode(mode);
+    srand(1234);
+
+    CharacterStream cstream(path);
+    RNNTrainer trainer(TRACE_LENGTH);
+    trainer.EnableEvaluation(HELD_OUT_CHARS, COMPARISON_EVALUATION_INTERVAL);
+    trainer.TrainLanguageNetwork(cstream, COMPARISON_ITERS);
+  }
+  return 0;
+}
+
 int main(int argc, char **argv) {
   srand(1234);
 
+  if (argc > 2 && string(argv[1]) == "serve") {
+    return serve(argv[2], argc > 3 ? argv[3] : "");
+  }
+  if (argc > 3 && string(argv[1]) == "complete") {
+    return complete(argv[2], argv[3]);
+  }
+  if (argc > 3 && string(argv[1]) == "export") {
+    return exportModel(argv[2], argv[3]);
+  }
+  if (argc > 1 && string(argv[1]) == "bench") {
+    return benchmark();
+  }
+  if (argc > 2 && string(argv[1]) == "approx") {
+    return compareTranscendentals(argv[2]);
+  }
+
   string path(argv[1]);
+  string checkpointPath(argc > 2 ? argv[2] : "");
 
   // testFFNetwork(path);
-  testRNN(path);
+  testRNN(path, checkpointPath);
 
   return 0;
 }
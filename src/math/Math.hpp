@@ -8,14 +8,25 @@
 
 typedef Eigen::VectorXf EVector;
 
-// TODO: row major is required for cuda (the way Ive implemented it), but is slower for cpu
-// computation.
-// typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> EMatrix;
-typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> EMatrix;
+// Matrices with a fixed layout, for storage formats and interfaces that depend on it.
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> ERowMatrix;
+typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic, Eigen::ColMajor> EColMatrix;
+
+// EMatrix is column major unless built with EMATRIX_ROW_MAJOR. Row major is the layout of
+// MatrixView and the CUDA kernels, so weights can then cross into a backend without repacking,
+// but column major is faster for most of the CPU code.
+#ifdef EMATRIX_ROW_MAJOR
+typedef ERowMatrix EMatrix;
+#else
+typedef EColMatrix EMatrix;
+#endif
 
 namespace math {
 
-static inline MatrixView GetMatrixView(EMatrix &m) {
+// MatrixView is row major, so only row major matrices can be viewed in place.
+template <typename Matrix> static inline MatrixView GetMatrixView(Matrix &m) {
+  static_assert(Matrix::IsRowMajor, "MatrixView data is row major");
+
   MatrixView result;
   result.rows = m.rows();
   result.cols = m.cols();
@@ -23,9 +34,35 @@ static inline MatrixView GetMatrixView(EMatrix &m) {
   return result;
 }
 
+// Views m in place when it is row major, otherwise copies it into scratch and views that.
+static inline MatrixView RowMajorView(ERowMatrix &m, ERowMatrix &) {
+  return GetMatrixView(m);
+}
+
+template <typename Matrix> static inline MatrixView RowMajorView(Matrix &m, ERowMatrix &scratch) {
+  scratch = m;
+  return GetMatrixView(scratch);
+}
+
+static inline Eigen::Map<ERowMatrix> MapMatrixView(const MatrixView &view) {
+  return Eigen::Map<ERowMatrix>(view.data, view.rows, view.cols);
+}
+
 // Returns a uniformly distributed random number between 0 and 1.
 static inline float UnitRand(void) { return rand() / (float)RAND_MAX; }
 
+// A uniform number between 0 and 1 that depends only on the key and index, so the same sequence
+// can be regenerated without storing it.
+static inline float HashUnitRand(unsigned key, unsigned index) {
+  unsigned h = key ^ (index * 0x27D4EB2Du);
+  h ^= h >> 16;
+  h *= 0x7FEB352Du;
+  h ^= h >> 15;
+  h *= 0x846CA68Bu;
+  h ^= h >> 16;
+  return (h >> 8) / static_cast<float>(1u << 24);
+}
+
 static inline float RandInterval(float s, float e) { return s + (e - s) * UnitRand(); }
 
 static inline float GaussianSample(float mean, float sd) {
@@ -44,26 +81,4 @@ static inline float GaussianSample(float mean, float sd) {
   // Box-Muller transform
   return mean + sd * y * sqrtf(-2.0f * logf(r2) / r2);
 }
-
-static inline EVector SoftmaxActivations(const EVector &in) {
-  assert(in.rows() > 0);
-  EVector result(in.rows());
-
-  float maxVal = in(0);
-  for (int r = 0; r < in.rows(); r++) {
-    maxVal = fmax(maxVal, in(r));
-  }
-
-  float sum = 0.0f;
-  for (int i = 0; i < in.rows(); i++) {
-    result(i) = expf(in(i)-maxVal);
-    sum += result(i);
-  }
-
-  for (int i = 0; i < result.rows(); i++) {
-    result(i) /= sum;
-  }
-
-  return result;
-}
 }
@@ -0,0 +1,116 @@
+
+#include "QuantisedMatrix.hpp"
+#include <cassert>
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace math;
+
+constexpr unsigned QuantisedMatrix::PADDING;
+
+QuantisedMatrix QuantisedMatrix::Quantise(const EMatrix &m) {
+  QuantisedMatrix result;
+  result.rows = m.rows();
+  result.cols = m.cols();
+  result.paddedCols = (m.cols() + PADDING - 1) / PADDING * PADDING;
+  result.data.assign(result.rows * result.paddedCols, 0);
+  result.rowScales.resize(result.rows);
+
+  for (unsigned r = 0; r < result.rows; r++) {
+    float maxAbs = m.row(r).cwiseAbs().maxCoeff();
+    float scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+    result.rowScales[r] = scale;
+
+    int8_t *row = result.data.data() + r * result.paddedCols;
+    for (unsigned c = 0; c < result.cols; c++) {
+      row[c] = static_cast<int8_t>(lrintf(m(r, c) / scale));
+    }
+  }
+
+  return result;
+}
+
+EMatrix QuantisedMatrix::Dequantise(void) const {
+  EMatrix result(rows, cols);
+  for (unsigned r = 0; r < rows; r++) {
+    for (unsigned c = 0; c < cols; c++) {
+      result(r, c) = rowScales[r] * Row(r)[c];
+    }
+  }
+  return result;
+}
+
+static int32_t dotProduct(const int8_t *a, const int16_t *b, unsigned n) {
+  assert(n % QuantisedMatrix::PADDING == 0);
+
+#if defined(__AVX2__)
+  __m256i sum = _mm256_setzero_si256();
+  for (unsigned i = 0; i < n; i += 16) {
+    __m256i wa = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)));
+    __m256i wb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(wa, wb));
+  }
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(s);
+#elif defined(__SSE2__)
+  __m128i sum = _mm_setzero_si128();
+  for (unsigned i = 0; i < n; i += 16) {
+    __m128i w = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i));
+    // Sign extend the int8 weights to int16 by unpacking against themselves and shifting.
+    __m128i wlo = _mm_srai_epi16(_mm_unpacklo_epi8(w, w), 8);
+    __m128i whi = _mm_srai_epi16(_mm_unpackhi_epi8(w, w), 8);
+    __m128i blo = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i));
+    __m128i bhi = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i + 8));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(wlo, blo));
+    sum = _mm_add_epi32(sum, _mm_madd_epi16(whi, bhi));
+  }
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+  sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+  return _mm_cvtsi128_si32(sum);
+#else
+  int32_t sum = 0;
+  for (unsigned i = 0; i < n; i++) {
+    sum += static_cast<int32_t>(a[i]) * b[i];
+  }
+  return sum;
+#endif
+}
+
+void math::QuantisedMultiplyAdd(const QuantisedMatrix &m, const Eigen::Ref<const EMatrix> &in,
+                                Eigen::Ref<EMatrix> out, QuantisedInputScratch &scratch) {
+  assert(in.rows() == m.cols);
+  assert(out.rows() == m.rows && out.cols() == in.cols());
+  assert(scratch.values.size() >= static_cast<size_t>(m.paddedCols * in.cols()));
+  assert(scratch.columnScales.size() >= static_cast<size_t>(in.cols()));
+
+  for (int c = 0; c < in.cols(); c++) {
+    float maxAbs = in.col(c).cwiseAbs().maxCoeff();
+    float scale = maxAbs > 0.0f ? maxAbs / 127.0f : 1.0f;
+    float invScale = 1.0f / scale;
+    scratch.columnScales[c] = scale;
+
+    int16_t *values = scratch.values.data() + c * m.paddedCols;
+    for (unsigned r = 0; r < m.cols; r++) {
+      values[r] = static_cast<int16_t>(lrintf(in(r, c) * invScale));
+    }
+    for (unsigned r = m.cols; r < m.paddedCols; r++) {
+      values[r] = 0;
+    }
+  }
+
+  // Each weight row is read once and applied to every batch column while it is in cache.
+  for (unsigned r = 0; r < m.rows; r++) {
+    const int8_t *row = m.Row(r);
+    for (int c = 0; c < in.cols(); c++) {
+      int32_t dot = dotProduct(row, scratch.values.data() + c * m.paddedCols, m.paddedCols);
+      out(r, c) += m.rowScales[r] * scratch.columnScales[c] * dot;
+    }
+  }
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "Math.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace math {
+
+// A matrix stored as int8 with one float scale per row: m(r, c) ~= rowScales[r] * data(r, c).
+// Rows are stored contiguously and padded with zeros to a multiple of PADDING columns, so the
+// kernels never need a scalar tail loop.
+struct QuantisedMatrix {
+  static constexpr unsigned PADDING = 32;
+
+  unsigned rows;
+  unsigned cols;
+  unsigned paddedCols;
+
+  std::vector<int8_t> data;
+  std::vector<float> rowScales;
+
+  QuantisedMatrix() : rows(0), cols(0), paddedCols(0) {}
+
+  static QuantisedMatrix Quantise(const EMatrix &m);
+  EMatrix Dequantise(void) const;
+
+  const int8_t *Row(unsigned r) const { return data.data() + r * paddedCols; }
+};
+
+// Space for the inputs of a QuantisedMultiplyAdd, quantised to int8 range per column. Kept by the
+// caller so that repeated products do not allocate.
+struct QuantisedInputScratch {
+  std::vector<int16_t> values;
+  std::vector<float> columnScales;
+
+  void Reserve(unsigned paddedRows, unsigned cols) {
+    values.resize(paddedRows * cols);
+    columnScales.resize(cols);
+  }
+};
+
+// out += m * in. Each column of in is quantised symmetrically to int8 range, the dot products are
+// accumulated in int32 using SIMD multiply-adds, and the result rescaled to float.
+void QuantisedMultiplyAdd(const QuantisedMatrix &m, const Eigen::Ref<const EMatrix> &in,
+                          Eigen::Ref<EMatrix> out, QuantisedInputScratch &scratch);
+}
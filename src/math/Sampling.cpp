@@ -0,0 +1,143 @@
+#include "Sampling.hpp"
+#include "Transcendentals.hpp"
+#include <algorithm>
+#include <limits>
+
+using namespace math;
+
+// The hashed uniforms are multiples of 2^-24 in [0, 1). Offsetting them by half a step keeps them
+// off 0, but the largest one then rounds to exactly 1, so they are also capped at the largest float
+// below 1. Both logs in the Gumbel transform then stay finite.
+static constexpr float HASH_STEP = 1.0f / static_cast<float>(1u << 24);
+static constexpr float MAX_OPEN_UNIT = 1.0f - HASH_STEP;
+
+static inline float openUnitRand(unsigned key, unsigned index) {
+  return std::min(HashUnitRand(key, index) + 0.5f * HASH_STEP, MAX_OPEN_UNIT);
+}
+
+static inline float gumbel(unsigned key, unsigned index) {
+  return -logf(-logf(openUnitRand(key, index)));
+}
+
+// Gumbel noise for every index below n. The uniforms are hashed in a plain loop and transformed
+// with the vectorised Log.
+static void gumbelNoise(unsigned key, unsigned n, EVector &out) {
+  out.resize(n);
+  for (unsigned i = 0; i < n; i++) {
+    out(i) = openUnitRand(key, i);
+  }
+  Log(out);
+  out = -out;
+  Log(out);
+  out = -out;
+}
+
+// Walks the first size weights and returns the position where u * total of their weight is reached.
+static unsigned inverseCDF(const EVector &weights, unsigned size, float total, float u) {
+  float r = u * total;
+  for (unsigned i = 0; i < size; i++) {
+    r -= weights(i);
+    if (r < 0.0f) {
+      return i;
+    }
+  }
+  return size - 1;
+}
+
+unsigned math::SampleLogits(const Eigen::Ref<const EVector> &logits, const SamplingConfig &config,
+                            std::mt19937 &rng, SamplingScratch &scratch) {
+  assert(logits.rows() > 0);
+  assert(config.temperature > 0.0f);
+  assert(config.topP > 0.0f);
+
+  const unsigned n = logits.rows();
+  const float invTemperature = 1.0f / config.temperature;
+  const unsigned key = rng();
+
+  const bool limitK = config.topK > 0 && config.topK < n;
+  const bool limitP = config.topP < 1.0f;
+  EVector &weights = scratch.values;
+
+  if (!limitK && !limitP) {
+    EVector::Index result;
+    if (config.method == SamplingMethod::GUMBEL_MAX) {
+      gumbelNoise(key, n, weights);
+      (logits.array() * invTemperature + weights.array()).maxCoeff(&result);
+      return result;
+    }
+
+    weights = (logits.array() - logits.maxCoeff()) * invTemperature;
+    Exp(weights);
+    return inverseCDF(weights, n, weights.sum(), HashUnitRand(key, n));
+  }
+
+  std::vector<unsigned> &candidates = scratch.candidates;
+  candidates.resize(n);
+  for (unsigned i = 0; i < n; i++) {
+    candidates[i] = i;
+  }
+
+  auto greater = [&logits](unsigned a, unsigned b) { return logits(a) > logits(b); };
+  if (limitK) {
+    std::nth_element(candidates.begin(), candidates.begin() + config.topK - 1,
+                     candidates.end(), greater);
+    candidates.resize(config.topK);
+  }
+
+  if (!limitP && config.method == SamplingMethod::GUMBEL_MAX) {
+    unsigned best = candidates.front();
+    float bestValue = -std::numeric_limits<float>::infinity();
+    for (unsigned c : candidates) {
+      float value = logits(c) * invTemperature + gumbel(key, c);
+      if (value > bestValue) {
+        best = c;
+        bestValue = value;
+      }
+    }
+    return best;
+  }
+
+  if (limitP) {
+    std::sort(candidates.begin(), candidates.end(), greater);
+  }
+
+  weights.resize(candidates.size());
+  for (unsigned i = 0; i < candidates.size(); i++) {
+    weights(i) = logits(candidates[i]);
+  }
+  weights = (weights.array() - weights.maxCoeff()) * invTemperature;
+  Exp(weights);
+
+  // The nucleus is the shortest prefix of the sorted candidates holding topP of the weight.
+  unsigned size = candidates.size();
+  float total = weights.sum();
+  if (limitP) {
+    const float threshold = config.topP * total;
+    total = 0.0f;
+    size = 0;
+    while (size < candidates.size() && total < threshold) {
+      total += weights(size++);
+    }
+  }
+
+  return candidates[inverseCDF(weights, size, total, HashUnitRand(key, n))];
+}
+
+void math::SampleLogits(const EMatrix &logits, const std::vector<SamplingConfig> &configs,
+                        std::vector<std::mt19937> &rngs, std::vector<unsigned> &out,
+                        SamplingScratch &scratch) {
+  assert(configs.size() == static_cast<size_t>(logits.cols()));
+  assert(rngs.size() == static_cast<size_t>(logits.cols()));
+
+  out.resize(logits.cols());
+  for (int c = 0; c < logits.cols(); c++) {
+    out[c] = SampleLogits(logits.col(c), configs[c], rngs[c], scratch);
+  }
+}
+
+float math::LogSoftmax(const Eigen::Ref<const EVector> &logits, unsigned index) {
+  assert(index < logits.rows());
+
+  float maxVal = logits.maxCoeff();
+  return logits(index) - maxVal - logf((logits.array() - maxVal).exp().sum());
+}
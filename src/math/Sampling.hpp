@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Math.hpp"
+#include <random>
+#include <vector>
+
+namespace math {
+
+// Inverse CDF walks the unnormalised weights exp(logit / temperature) with a single uniform.
+// Gumbel-max takes the argmax of logit / temperature plus Gumbel noise, needing neither the
+// weights' sum nor a walk, but two logarithms per candidate.
+enum class SamplingMethod {
+  INVERSE_CDF,
+  GUMBEL_MAX,
+};
+
+// How to draw from softmax(logits / temperature). The candidates can first be limited to the topK
+// largest logits and then to the smallest set of most likely ones whose probability reaches topP.
+// A nucleus is always sampled by inverse CDF.
+struct SamplingConfig {
+  float temperature;
+  unsigned topK; // 0 keeps every candidate.
+  float topP;    // 1 keeps every candidate.
+  SamplingMethod method;
+
+  SamplingConfig(float temperature, unsigned topK = 0, float topP = 1.0f,
+                 SamplingMethod method = SamplingMethod::INVERSE_CDF)
+      : temperature(temperature), topK(topK), topP(topP), method(method) {}
+};
+
+// Working memory for the samplers, reused between calls so sampling does not allocate.
+struct SamplingScratch {
+  std::vector<unsigned> candidates;
+  EVector values;
+};
+
+// Draws an index from the distribution described by config without ever normalising the softmax.
+// Each call takes exactly one value from rng, the Gumbel noise is hashed from it, so a stream's
+// samples depend only on its own rng.
+unsigned SampleLogits(const Eigen::Ref<const EVector> &logits, const SamplingConfig &config,
+                      std::mt19937 &rng, SamplingScratch &scratch);
+
+// Samples every column of logits, each with its own config and rng.
+void SampleLogits(const EMatrix &logits, const std::vector<SamplingConfig> &configs,
+                  std::vector<std::mt19937> &rngs, std::vector<unsigned> &out,
+                  SamplingScratch &scratch);
+
+// log(softmax(logits)(index)), for scoring a sample drawn from logits.
+float LogSoftmax(const Eigen::Ref<const EVector> &logits, unsigned index);
+}
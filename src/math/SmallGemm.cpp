@@ -0,0 +1,450 @@
+#include "SmallGemm.hpp"
+#include <algorithm>
+#include <utility>
+
+using namespace math;
+
+// Products whose batch side is at most this wide use the kernels. A single column is left to
+// Eigen's matrix-vector product, which does not pack either. With -O3 the kernels stop beating
+// Eigen's forward product between batches of 8 and 12.
+static constexpr int MAX_NARROW = 8;
+
+// Packed matrices storing at most this fraction of their blocks use the packed kernels at any
+// batch width, since skipping blocks saves more than Eigen gains on wide batches.
+static constexpr float MAX_SPARSE_DENSITY = 0.75f;
+
+// A product kernel step computes MR rows by NR columns of the result, so the accumulators and a
+// column of the left operand stay in registers.
+static constexpr int MR = PackedMatrix::PANEL_ROWS;
+static constexpr int NR = 2;
+static constexpr int BC = PackedMatrix::BLOCK_COLS;
+
+// A transposed kernel step computes TP x TW dot products, each in LANES independent partial sums
+// so that they vectorise.
+static constexpr int TP = 3;
+static constexpr int TW = 3;
+static constexpr int LANES = 4;
+
+typedef Eigen::Matrix<float, MR, 1> Column;
+typedef Eigen::Array<float, LANES, 1> Lanes;
+typedef Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> Strides;
+
+constexpr unsigned PackedMatrix::PANEL_ROWS;
+constexpr unsigned PackedMatrix::BLOCK_COLS;
+
+static bool isNarrow(int batchSize) { return batchSize > 1 && batchSize <= MAX_NARROW; }
+
+// An unpacked left operand has to be column major for the kernels.
+static bool useKernels(int batchSize) {
+  return !EMatrix::IsRowMajor && isNarrow(batchSize);
+}
+
+static bool isSparse(const PackedMatrix &m) { return m.Density() <= MAX_SPARSE_DENSITY; }
+
+// Calls f(index, firstRow, firstCol, blockRows, blockCols) for every block of a rows x cols
+// matrix, in PackedMatrix's order.
+template <typename F> static void forEachBlock(int rows, int cols, F &&f) {
+  for (int r = 0, index = 0; r < rows; r += MR) {
+    for (int c = 0; c < cols; c += BC, index++) {
+      f(index, r, c, std::min(MR, rows - r), std::min(BC, cols - c));
+    }
+  }
+}
+
+// Where b and c are, and how to step through them. Only the left operand has to be column major.
+struct Operands {
+  const float *b;
+  int bRowStride, bColStride;
+  float *c;
+  int cRowStride, cColStride;
+
+  Operands(const Eigen::Ref<const EMatrix> &b, Eigen::Ref<EMatrix> &c)
+      : b(b.data()), bRowStride(b.rowStride()), bColStride(b.colStride()), c(c.data()),
+        cRowStride(c.rowStride()), cColStride(c.colStride()) {}
+
+  Operands Offset(int row, int col) const {
+    Operands result(*this);
+    result.b += col * bColStride;
+    result.c += row * cRowStride + col * cColStride;
+    return result;
+  }
+};
+
+// acc(R x W) += a(R x k) * b(k x W), where a is column major.
+template <int R, int W>
+static void accumulate(Eigen::Matrix<float, R, W> &acc, const float *a, int lda, const float *b,
+                       int bRowStride, int bColStride, int k) {
+  typedef Eigen::Matrix<float, R, 1> RowsColumn;
+
+  for (int p = 0; p < k; p++, b += bRowStride) {
+    const Eigen::Map<const RowsColumn> ap(a + p * lda);
+    for (int j = 0; j < W; j++) {
+      acc.col(j) += ap * b[j * bColStride];
+    }
+  }
+}
+
+// Adds the first rows rows of acc to c.
+template <int R, int W>
+static void store(const Eigen::Matrix<float, R, W> &acc, const Operands &op, int rows) {
+  typedef Eigen::Matrix<float, R, W> Tile;
+
+  // A single row tile is row major, so its outer stride steps between rows.
+  const int outerStride = Tile::IsRowMajor ? op.cRowStride : op.cColStride;
+  const int innerStride = Tile::IsRowMajor ? op.cColStride : op.cRowStride;
+  Eigen::Map<Tile, Eigen::Unaligned, Strides> out(op.c, Strides(outerStride, innerStride));
+  if (rows == R) {
+    out += acc;
+  } else {
+    out.topRows(rows) += acc.topRows(rows);
+  }
+}
+
+// c(rows x W) += a(R x k) * b(k x W), where only the first rows rows of the result are stored.
+template <int R, int W>
+static void productKernel(const float *a, int lda, const Operands &op, int k, int rows) {
+  Eigen::Matrix<float, R, W> acc = Eigen::Matrix<float, R, W>::Zero();
+  accumulate<R, W>(acc, a, lda, op.b, op.bRowStride, op.bColStride, k);
+  store<R, W>(acc, op, rows);
+}
+
+// c(rows x n) += a(R x k) * b(k x n). The R rows of a stay in L1 while they are used for every
+// column of the result.
+template <int R>
+static void productRows(const float *a, int lda, const Operands &op, int n, int k, int rows) {
+  int j = 0;
+  for (; j + NR <= n; j += NR) {
+    productKernel<R, NR>(a, lda, op.Offset(0, j), k, rows);
+  }
+  for (; j < n; j++) {
+    productKernel<R, 1>(a, lda, op.Offset(0, j), k, rows);
+  }
+}
+
+// c(m x n) += a(m x k) * b(k x n), with the rows that do not fill a whole step done in smaller
+// ones.
+static void addProduct(const float *a, int lda, const Operands &op, int m, int n, int k) {
+  int i = 0;
+  for (; i + MR <= m; i += MR) {
+    productRows<MR>(a + i, lda, op.Offset(i, 0), n, k, MR);
+  }
+  if (i + MR / 2 <= m) {
+    productRows<MR / 2>(a + i, lda, op.Offset(i, 0), n, k, MR / 2);
+    i += MR / 2;
+  }
+  if (i + MR / 4 <= m) {
+    productRows<MR / 4>(a + i, lda, op.Offset(i, 0), n, k, MR / 4);
+    i += MR / 4;
+  }
+  for (; i < m; i++) {
+    productRows<1>(a + i, lda, op.Offset(i, 0), n, k, 1);
+  }
+}
+
+// c(P x W) += a(m x P)^T * b(m x W), as dot products of columns.
+template <int P, int W>
+static void dotKernel(const float *a, int lda, const float *b, int ldb, float *c, int ldc, int m) {
+  Lanes acc[P][W];
+  for (int p = 0; p < P; p++) {
+    for (int w = 0; w < W; w++) {
+      acc[p][w].setZero();
+    }
+  }
+
+  int i = 0;
+  for (; i + LANES <= m; i += LANES) {
+    for (int w = 0; w < W; w++) {
+      const Lanes bw = Eigen::Map<const Lanes>(b + w * ldb + i);
+      for (int p = 0; p < P; p++) {
+        acc[p][w] += Eigen::Map<const Lanes>(a + p * lda + i) * bw;
+      }
+    }
+  }
+
+  for (int p = 0; p < P; p++) {
+    for (int w = 0; w < W; w++) {
+      float sum = acc[p][w].sum();
+      for (int t = i; t < m; t++) {
+        sum += a[p * lda + t] * b[w * ldb + t];
+      }
+      c[w * ldc + p] += sum;
+    }
+  }
+}
+
+template <int P>
+static void addTransposedRows(const float *a, int lda, const float *b, int ldb, float *c, int ldc,
+                              int m, int n) {
+  int j = 0;
+  for (; j + TW <= n; j += TW) {
+    dotKernel<P, TW>(a, lda, b + j * ldb, ldb, c + j * ldc, ldc, m);
+  }
+  for (; j < n; j++) {
+    dotKernel<P, 1>(a, lda, b + j * ldb, ldb, c + j * ldc, ldc, m);
+  }
+}
+
+// c(p x n) += a(m x p)^T * b(m x n).
+static void addTransposedProduct(const float *a, int lda, const float *b, int ldb, float *c,
+                                 int ldc, int m, int p, int n) {
+  int i = 0;
+  for (; i + TP <= p; i += TP) {
+    addTransposedRows<TP>(a + i * lda, lda, b, ldb, c + i, ldc, m, n);
+  }
+  for (; i < p; i++) {
+    addTransposedRows<1>(a + i * lda, lda, b, ldb, c + i, ldc, m, n);
+  }
+}
+
+void math::AddProduct(const Eigen::Ref<const EMatrix> &a, const Eigen::Ref<const EMatrix> &b,
+                      Eigen::Ref<EMatrix> c) {
+  assert(a.cols() == b.rows());
+  assert(c.rows() == a.rows() && c.cols() == b.cols());
+
+  if (useKernels(b.cols())) {
+    addProduct(a.data(), a.outerStride(), Operands(b, c), c.rows(), c.cols(), a.cols());
+  } else {
+    c.noalias() += a * b;
+  }
+}
+
+void math::AddProductTransA(const Eigen::Ref<const EMatrix> &a,
+                            const Eigen::Ref<const EMatrix> &b, Eigen::Ref<EMatrix> c) {
+  assert(a.rows() == b.rows());
+  assert(c.rows() == a.cols() && c.cols() == b.cols());
+
+  if (useKernels(b.cols())) {
+    addTransposedProduct(a.data(), a.outerStride(), b.data(), b.outerStride(), c.data(),
+                         c.outerStride(), a.rows(), c.rows(), c.cols());
+  } else {
+    c.noalias() += a.transpose() * b;
+  }
+}
+
+// c(rows x W) += the stored blocks of a panel times the rows of b they cover.
+template <int W>
+static void panelKernel(const PackedMatrix &a, unsigned panel, const Operands &op, int rows) {
+  Eigen::Matrix<float, MR, W> acc = Eigen::Matrix<float, MR, W>::Zero();
+  for (unsigned i = a.panelStart[panel]; i < a.panelStart[panel + 1]; i++) {
+    const int firstCol = a.blockCols[i] * BC;
+    accumulate<MR, W>(acc, a.Block(i), MR, op.b + firstCol * op.bRowStride, op.bRowStride,
+                      op.bColStride, std::min<int>(BC, a.cols - firstCol));
+  }
+  store<MR, W>(acc, op, rows);
+}
+
+// c += a^T * b over a's stored blocks. For every column of b, each block adds its transpose times
+// the part of the column its rows cover.
+static void addTransposedPacked(const PackedMatrix &a, const Operands &op, int n) {
+  typedef Eigen::Matrix<float, MR, BC> Block;
+  typedef Eigen::Matrix<float, BC, 1> BlockDots;
+
+  Column bPart;
+  for (unsigned panel = 0; panel < a.NumPanels(); panel++) {
+    const int firstRow = panel * MR;
+    const int rows = std::min<int>(MR, a.rows - firstRow);
+
+    for (int j = 0; j < n; j++) {
+      bPart.setZero();
+      const float *bp = op.b + firstRow * op.bRowStride + j * op.bColStride;
+      for (int r = 0; r < rows; r++) {
+        bPart(r) = bp[r * op.bRowStride];
+      }
+
+      for (unsigned i = a.panelStart[panel]; i < a.panelStart[panel + 1]; i++) {
+        const int firstCol = a.blockCols[i] * BC;
+        const int width = std::min<int>(BC, a.cols - firstCol);
+
+        const BlockDots dots = Eigen::Map<const Block>(a.Block(i)).transpose() * bPart;
+        float *cp = op.c + firstCol * op.cRowStride + j * op.cColStride;
+        for (int p = 0; p < width; p++) {
+          cp[p * op.cRowStride] += dots(p);
+        }
+      }
+    }
+  }
+}
+
+// c(MR x W) += a(MR x n) * b(W x n)^T, one gradient block accumulated over the batch.
+template <int W>
+static void gradientKernel(const float *a, int lda, const float *b, int ldb, float *c, int ldc,
+                           int n) {
+  typedef Eigen::Matrix<float, MR, W> Tile;
+
+  Tile acc = Tile::Zero();
+  for (int j = 0; j < n; j++) {
+    const Eigen::Map<const Column> aj(a + j * lda);
+    for (int q = 0; q < W; q++) {
+      acc.col(q) += aj * b[j * ldb + q];
+    }
+  }
+  Eigen::Map<Tile, Eigen::Unaligned, Eigen::OuterStride<>> out(c, Eigen::OuterStride<>(ldc));
+  out += acc;
+}
+
+// c += a * b^T over the blocks that packed stores. Whole blocks of column major operands use the
+// kernel, anything else Eigen's product of the block.
+static void addMaskedGradient(const Eigen::Ref<const EMatrix> &a,
+                              const Eigen::Ref<const EMatrix> &b, const PackedMatrix &packed,
+                              Eigen::Ref<EMatrix> &c) {
+  for (unsigned panel = 0; panel < packed.NumPanels(); panel++) {
+    const int firstRow = panel * MR;
+    const int rows = std::min<int>(MR, packed.rows - firstRow);
+
+    for (unsigned i = packed.panelStart[panel]; i < packed.panelStart[panel + 1]; i++) {
+      const int firstCol = packed.blockCols[i] * BC;
+      const int width = std::min<int>(BC, packed.cols - firstCol);
+
+      if (EMatrix::IsRowMajor || rows < MR || width < BC) {
+        c.block(firstRow, firstCol, rows, width).noalias() +=
+            a.middleRows(firstRow, rows) * b.middleRows(firstCol, width).transpose();
+        continue;
+      }
+
+      // Half a block at a time, so the accumulators stay in registers.
+      for (int q = 0; q < BC; q += BC / 2) {
+        gradientKernel<BC / 2>(a.data() + firstRow, a.outerStride(), b.data() + firstCol + q,
+                               b.outerStride(), &c(firstRow, firstCol + q), c.outerStride(),
+                               a.cols());
+      }
+    }
+  }
+}
+
+PackedMatrix PackedMatrix::Pack(const Eigen::Ref<const EMatrix> &m) {
+  PackedMatrix result;
+  result.rows = m.rows();
+  result.cols = m.cols();
+
+  const BlockMask stored = NonZeroBlocks(m);
+  const unsigned colBlocks = result.NumColBlocks();
+  forEachBlock(m.rows(), m.cols(), [&](int index, int firstRow, int firstCol, int rows, int cols) {
+    if (stored[index]) {
+      result.blockCols.push_back(index % colBlocks);
+
+      size_t offset = result.data.size();
+      result.data.resize(offset + PANEL_ROWS * BLOCK_COLS, 0.0f);
+      for (int c = 0; c < cols; c++) {
+        for (int r = 0; r < rows; r++) {
+          result.data[offset + c * PANEL_ROWS + r] = m(firstRow + r, firstCol + c);
+        }
+      }
+    }
+
+    if (index % colBlocks == colBlocks - 1) {
+      result.panelStart.push_back(result.blockCols.size());
+    }
+  });
+
+  assert(result.panelStart.size() == result.NumPanels() + 1);
+  return result;
+}
+
+float PackedMatrix::Density(void) const {
+  unsigned numBlocks = NumPanels() * NumColBlocks();
+  return numBlocks > 0 ? blockCols.size() / static_cast<float>(numBlocks) : 1.0f;
+}
+
+void math::AddProduct(const PackedMatrix &a, const Eigen::Ref<const EMatrix> &b,
+                      Eigen::Ref<EMatrix> c) {
+  assert(a.cols == b.rows());
+  assert(c.rows() == a.rows && c.cols() == b.cols());
+
+  const Operands op(b, c);
+  for (unsigned panel = 0; panel < a.NumPanels(); panel++) {
+    const int firstRow = panel * MR;
+    const int rows = std::min<int>(MR, a.rows - firstRow);
+
+    int j = 0;
+    for (; j + NR <= c.cols(); j += NR) {
+      panelKernel<NR>(a, panel, op.Offset(firstRow, j), rows);
+    }
+    for (; j < c.cols(); j++) {
+      panelKernel<1>(a, panel, op.Offset(firstRow, j), rows);
+    }
+  }
+}
+
+void math::AddProductTransA(const PackedMatrix &a, const Eigen::Ref<const EMatrix> &b,
+                            Eigen::Ref<EMatrix> c) {
+  assert(a.rows == b.rows());
+  assert(c.rows() == a.cols && c.cols() == b.cols());
+
+  addTransposedPacked(a, Operands(b, c), c.cols());
+}
+
+void math::AddProduct(const Eigen::Ref<const EMatrix> &a, const PackedMatrix &packed,
+                      const Eigen::Ref<const EMatrix> &b, Eigen::Ref<EMatrix> c) {
+  assert(packed.rows == a.rows() && packed.cols == a.cols());
+
+  if (isNarrow(b.cols()) || isSparse(packed)) {
+    AddProduct(packed, b, c);
+  } else {
+    c.noalias() += a * b;
+  }
+}
+
+void math::AddProductTransA(const Eigen::Ref<const EMatrix> &a, const PackedMatrix &packed,
+                            const Eigen::Ref<const EMatrix> &b, Eigen::Ref<EMatrix> c) {
+  assert(packed.rows == a.rows() && packed.cols == a.cols());
+
+  if (isSparse(packed)) {
+    AddProductTransA(packed, b, c);
+  } else {
+    AddProductTransA(a, b, c);
+  }
+}
+
+void math::AddProductTransB(const Eigen::Ref<const EMatrix> &a,
+                            const Eigen::Ref<const EMatrix> &b, const PackedMatrix &packed,
+                            Eigen::Ref<EMatrix> c) {
+  assert(a.cols() == b.cols());
+  assert(c.rows() == a.rows() && c.cols() == b.rows());
+  assert(packed.rows == c.rows() && packed.cols == c.cols());
+
+  if (isSparse(packed)) {
+    addMaskedGradient(a, b, packed, c);
+  } else {
+    c.noalias() += a * b.transpose();
+  }
+}
+
+BlockMask math::LargestBlocks(const Eigen::Ref<const EMatrix> &m, float density) {
+  assert(density >= 0.0f && density <= 1.0f);
+
+  typedef std::pair<float, int> BlockNorm;
+
+  std::vector<BlockNorm> norms;
+  forEachBlock(m.rows(), m.cols(), [&](int index, int firstRow, int firstCol, int rows, int cols) {
+    norms.emplace_back(m.block(firstRow, firstCol, rows, cols).squaredNorm(), index);
+  });
+
+  // Ties are broken by position, so the mask is deterministic.
+  std::sort(norms.begin(), norms.end(), [](const BlockNorm &a, const BlockNorm &b) {
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+  });
+
+  BlockMask result(norms.size(), false);
+  const unsigned numKept = lrintf(density * norms.size());
+  for (unsigned i = 0; i < numKept; i++) {
+    result[norms[i].second] = true;
+  }
+  return result;
+}
+
+BlockMask math::NonZeroBlocks(const Eigen::Ref<const EMatrix> &m) {
+  BlockMask result;
+  forEachBlock(m.rows(), m.cols(), [&](int index, int firstRow, int firstCol, int rows, int cols) {
+    result.push_back(!m.block(firstRow, firstCol, rows, cols).isZero(0.0f));
+  });
+  return result;
+}
+
+void math::ApplyBlockMask(const BlockMask &mask, Eigen::Ref<EMatrix> m) {
+  forEachBlock(m.rows(), m.cols(), [&](int index, int firstRow, int firstCol, int rows, int cols) {
+    assert(index < static_cast<int>(mask.size()));
+    if (!mask[index]) {
+      m.block(firstRow, firstCol, rows, cols).setZero();
+    }
+  });
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Math.hpp"
+#include <vector>
+
+namespace math {
+
+// Matrix products for the shapes of a small-batch RNN step, where one operand is only a batch of
+// columns wide. Eigen's general product packs both operands into blocks on every call, which at
+// these sizes is a noticeable part of the work. When the batch side is narrow these run register
+// blocked kernels on the operands in place, otherwise they defer to Eigen. The kernels assume
+// column major storage, so a row major build always uses Eigen.
+//
+// Each adds its product to c, which must not alias a or b.
+
+// c += a * b
+void AddProduct(const Eigen::Ref<const EMatrix> &a, const Eigen::Ref<const EMatrix> &b,
+                Eigen::Ref<EMatrix> c);
+
+// c += a^T * b
+void AddProductTransA(const Eigen::Ref<const EMatrix> &a, const Eigen::Ref<const EMatrix> &b,
+                      Eigen::Ref<EMatrix> c);
+
+// A matrix laid out for repeated products: panels of PANEL_ROWS rows, each cut into blocks of
+// BLOCK_COLS columns stored one after another, column major and padded with zeros. The kernels
+// then stream through it rather than gathering a column segment per step. Packing costs about a
+// third of a product at a batch of 16, so it pays off for weights that multiply a batch at every
+// timestep of a trace.
+//
+// Blocks that are entirely zero are left out, so a matrix pruned a block at a time only costs its
+// kept blocks in the products.
+struct PackedMatrix {
+  static constexpr unsigned PANEL_ROWS = 16;
+  static constexpr unsigned BLOCK_COLS = 8;
+
+  unsigned rows;
+  unsigned cols;
+
+  // Panel p stores the column blocks blockCols[panelStart[p]] up to blockCols[panelStart[p + 1]],
+  // and the i-th stored block starts at Block(i).
+  std::vector<unsigned> panelStart;
+  std::vector<unsigned> blockCols;
+  std::vector<float> data;
+
+  PackedMatrix() : rows(0), cols(0), panelStart(1, 0) {}
+
+  static PackedMatrix Pack(const Eigen::Ref<const EMatrix> &m);
+
+  unsigned NumPanels(void) const { return (rows + PANEL_ROWS - 1) / PANEL_ROWS; }
+  unsigned NumColBlocks(void) const { return (cols + BLOCK_COLS - 1) / BLOCK_COLS; }
+
+  // The fraction of blocks that are stored.
+  float Density(void) const;
+
+  const float *Block(unsigned i) const { return data.data() + i * PANEL_ROWS * BLOCK_COLS; }
+};
+
+// c += a * b, with the kernels whatever the batch width or storage order.
+void AddProduct(const PackedMatrix &a, const Eigen::Ref<const EMatrix> &b, Eigen::Ref<EMatrix> c);
+
+// c += a^T * b, with the kernels whatever the batch width or storage order.
+void AddProductTransA(const PackedMatrix &a, const Eigen::Ref<const EMatrix> &b,
+                      Eigen::Ref<EMatrix> c);
+
+// The products of a connection's training step, given its weights a and their packed form. Block
+// sparse weights always use the packed form, dense ones it or the unpacked kernels for narrow
+// batches, and Eigen otherwise.
+
+// c += a * b
+void AddProduct(const Eigen::Ref<const EMatrix> &a, const PackedMatrix &packed,
+                const Eigen::Ref<const EMatrix> &b, Eigen::Ref<EMatrix> c);
+
+// c += a^T * b
+void AddProductTransA(const Eigen::Ref<const EMatrix> &a, const PackedMatrix &packed,
+                      const Eigen::Ref<const EMatrix> &b, Eigen::Ref<EMatrix> c);
+
+// c += a * b^T, the gradient of the packed weights, where a holds the output deltas and b the
+// inputs. When packed is block sparse only its stored blocks of c are added to.
+void AddProductTransB(const Eigen::Ref<const EMatrix> &a, const Eigen::Ref<const EMatrix> &b,
+                      const PackedMatrix &packed, Eigen::Ref<EMatrix> c);
+
+// Which of a matrix's blocks, as laid out by PackedMatrix and numbered panel by panel, are kept.
+typedef std::vector<bool> BlockMask;
+
+// Keeps the given fraction of m's blocks, those with the largest L2 norms.
+BlockMask LargestBlocks(const Eigen::Ref<const EMatrix> &m, float density);
+
+// Keeps the blocks of m that are not entirely zero.
+BlockMask NonZeroBlocks(const Eigen::Ref<const EMatrix> &m);
+
+// Zeroes every block of m that mask does not keep.
+void ApplyBlockMask(const BlockMask &mask, Eigen::Ref<EMatrix> m);
+}
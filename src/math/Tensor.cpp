@@ -3,8 +3,54 @@
 #include <algorithm>
 #include <cassert>
 
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
 using namespace math;
 
+// Tensors with fewer elements than this are processed on the calling thread.
+static constexpr size_t PARALLEL_THRESHOLD = 64 * 1024;
+
+// Elements per block when running in parallel.
+static constexpr unsigned BLOCK_SIZE = 16 * 1024;
+
+namespace {
+
+struct Block {
+  unsigned layer;
+  unsigned start;
+  unsigned size;
+
+  Block(unsigned layer, unsigned start, unsigned size) : layer(layer), start(start), size(size) {}
+};
+}
+
+static void assertSameShape(const Tensor &a, const Tensor &b) {
+  assert(a.NumLayers() == b.NumLayers());
+  for (unsigned i = 0; i < a.NumLayers(); i++) {
+    assert(a(i).rows() == b(i).rows());
+    assert(a(i).cols() == b(i).cols());
+  }
+}
+
+static size_t numElements(const Tensor &t) {
+  size_t result = 0;
+  for (unsigned i = 0; i < t.NumLayers(); i++) {
+    result += t(i).size();
+  }
+  return result;
+}
+
+static vector<Block> makeBlocks(const Tensor &t) {
+  vector<Block> result;
+  for (unsigned i = 0; i < t.NumLayers(); i++) {
+    for (unsigned start = 0; start < t(i).size(); start += BLOCK_SIZE) {
+      result.emplace_back(i, start, min<unsigned>(BLOCK_SIZE, t(i).size() - start));
+    }
+  }
+  return result;
+}
+
 unsigned Tensor::NumLayers(void) const { return this->data.size(); }
 void Tensor::AddLayer(const EMatrix &m) { this->data.push_back(m); }
 
@@ -49,57 +95,130 @@ Tensor Tensor::operator/(float s) const {
 }
 
 Tensor &Tensor::operator*=(const Tensor &t) {
-  assert(this->NumLayers() == t.NumLayers());
-  for (unsigned i = 0; i < NumLayers(); i++) {
-    assert(data[i].rows() == t.data[i].rows());
-    assert(data[i].cols() == t.data[i].cols());
-
-    for (int y = 0; y < data[i].rows(); y++) {
-      for (int x = 0; x < data[i].cols(); x++) {
-        data[i](y, x) *= t.data[i](y, x);
-      }
-    }
-  }
+  assertSameShape(*this, t);
+  ForEachBlock([this, &t](unsigned layer, unsigned start, unsigned size) {
+    Segment(layer, start, size) *= t.Segment(layer, start, size);
+  });
   return *this;
 }
 
 Tensor &Tensor::operator+=(const Tensor &t) {
-  assert(this->NumLayers() == t.NumLayers());
-  for (unsigned i = 0; i < NumLayers(); i++) {
-    data[i] += t.data[i];
-  }
+  assertSameShape(*this, t);
+  ForEachBlock([this, &t](unsigned layer, unsigned start, unsigned size) {
+    Segment(layer, start, size) += t.Segment(layer, start, size);
+  });
   return *this;
 }
 
 Tensor &Tensor::operator-=(const Tensor &t) {
-  assert(this->NumLayers() == t.NumLayers());
-  for (unsigned i = 0; i < NumLayers(); i++) {
-    data[i] -= t.data[i];
-  }
+  assertSameShape(*this, t);
+  ForEachBlock([this, &t](unsigned layer, unsigned start, unsigned size) {
+    Segment(layer, start, size) -= t.Segment(layer, start, size);
+  });
   return *this;
 }
 
 Tensor &Tensor::operator*=(float s) {
-  for_each(data, [=](EMatrix &m) { m *= s; });
+  ForEachBlock([this, s](unsigned layer, unsigned start, unsigned size) {
+    Segment(layer, start, size) *= s;
+  });
   return *this;
 }
 
 Tensor &Tensor::operator/=(float s) {
-  float inv = 1.0f / s;
-  for_each(data, [=](EMatrix &m) { m *= inv; });
+  return *this *= 1.0f / s;
+}
+
+Tensor &Tensor::Axpby(float a, const Tensor &x, float b) {
+  assertSameShape(*this, x);
+  ForEachBlock([this, a, &x, b](unsigned layer, unsigned start, unsigned size) {
+    auto y = Segment(layer, start, size);
+    y = a * x.Segment(layer, start, size) + b * y;
+  });
   return *this;
 }
 
-double Tensor::L2Magnitude(void) const {
-  double sum2 = 0.0f;
+Tensor &Tensor::AxpbySquared(float a, const Tensor &x, float b) {
+  assertSameShape(*this, x);
+  ForEachBlock([this, a, &x, b](unsigned layer, unsigned start, unsigned size) {
+    auto y = Segment(layer, start, size);
+    y = a * x.Segment(layer, start, size).square() + b * y;
+  });
+  return *this;
+}
 
-  for (unsigned i = 0; i < NumLayers(); i++) {
-    for (int r = 0; r < data[i].rows(); r++) {
-      for (int c = 0; c < data[i].cols(); c++) {
-        sum2 += data[i](r, c) * data[i](r, c);
-      }
+double Tensor::L2Magnitude(void) const {
+  // Every block has its own partial sum, so the total does not depend on the scheduling.
+  vector<Block> blocks = makeBlocks(*this);
+  vector<double> partials(blocks.size());
+
+  auto sumBlocks = [this, &blocks, &partials](const tbb::blocked_range<unsigned> &r) {
+    for (unsigned i = r.begin(); i != r.end(); i++) {
+      partials[i] = Segment(blocks[i].layer, blocks[i].start, blocks[i].size)
+                        .cast<double>()
+                        .square()
+                        .sum();
     }
+  };
+
+  tbb::blocked_range<unsigned> range(0, blocks.size());
+  if (numElements(*this) < PARALLEL_THRESHOLD) {
+    sumBlocks(range);
+  } else {
+    tbb::parallel_for(range, sumBlocks);
   }
 
+  double sum2 = 0.0;
+  for (double partial : partials) {
+    sum2 += partial;
+  }
   return sum2;
 }
+
+Tensor Tensor::Mean(vector<Tensor> &&tensors) {
+  assert(!tensors.empty());
+
+  Tensor result = move(tensors[0]);
+  for (unsigned i = 1; i < tensors.size(); i++) {
+    assertSameShape(result, tensors[i]);
+  }
+
+  const float scale = 1.0f / tensors.size();
+  result.ForEachBlock([&result, &tensors, scale](unsigned layer, unsigned start, unsigned size) {
+    auto sum = result.Segment(layer, start, size);
+    for (unsigned i = 1; i < tensors.size(); i++) {
+      sum += tensors[i].Segment(layer, start, size);
+    }
+    sum *= scale;
+  });
+
+  return result;
+}
+
+void Tensor::ForEachBlock(const std::function<void(unsigned, unsigned, unsigned)> &func) const {
+  if (numElements(*this) < PARALLEL_THRESHOLD) {
+    for (unsigned i = 0; i < NumLayers(); i++) {
+      func(i, 0, data[i].size());
+    }
+    return;
+  }
+
+  vector<Block> blocks = makeBlocks(*this);
+  tbb::parallel_for(tbb::blocked_range<unsigned>(0, blocks.size()),
+                    [&blocks, &func](const tbb::blocked_range<unsigned> &r) {
+                      for (unsigned i = r.begin(); i != r.end(); i++) {
+                        func(blocks[i].layer, blocks[i].start, blocks[i].size);
+                      }
+                    });
+}
+
+Eigen::Map<Eigen::ArrayXf> Tensor::Segment(unsigned layer, unsigned start, unsigned size) {
+  assert(layer < data.size() && start + size <= data[layer].size());
+  return Eigen::Map<Eigen::ArrayXf>(data[layer].data() + start, size);
+}
+
+Eigen::Map<const Eigen::ArrayXf> Tensor::Segment(unsigned layer, unsigned start,
+                                                 unsigned size) const {
+  assert(layer < data.size() && start + size <= data[layer].size());
+  return Eigen::Map<const Eigen::ArrayXf>(data[layer].data() + start, size);
+}
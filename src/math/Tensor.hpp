@@ -2,6 +2,7 @@
 
 #include "../common/Common.hpp"
 #include "Math.hpp"
+#include <functional>
 
 namespace math {
 
@@ -25,8 +26,23 @@ public:
   Tensor &operator*=(float s);
   Tensor &operator/=(float s);
 
+  // Fused in-place updates, one vectorised pass with no temporaries.
+  Tensor &Axpby(float a, const Tensor &x, float b);        // this = a * x + b * this
+  Tensor &AxpbySquared(float a, const Tensor &x, float b); // this = a * x^2 + b * this
+
   double L2Magnitude(void) const;
 
+  // The elementwise mean of the tensors, computed in one pass in the first tensor's storage.
+  static Tensor Mean(vector<Tensor> &&tensors);
+
+  // Calls func(layer, start, size) for blocks covering every layer's elements in storage order,
+  // spread over the TBB pool when the tensor is large enough to be worth it.
+  void ForEachBlock(const std::function<void(unsigned, unsigned, unsigned)> &func) const;
+
+  // A block of a layer's elements in storage order, as an array.
+  Eigen::Map<Eigen::ArrayXf> Segment(unsigned layer, unsigned start, unsigned size);
+  Eigen::Map<const Eigen::ArrayXf> Segment(unsigned layer, unsigned start, unsigned size) const;
+
 private:
   vector<EMatrix> data;
 };
@@ -0,0 +1,193 @@
+#include "Transcendentals.hpp"
+#include <algorithm>
+
+using namespace math;
+using namespace Eigen::internal;
+
+// The fast functions are written in Eigen's packet primitives, so they vectorise for whichever
+// instruction set the build targets.
+typedef packet_traits<float>::type FloatPacket;
+static constexpr int PACKET_SIZE = packet_traits<float>::size;
+
+#ifdef FAST_TRANSCENDENTALS
+static TranscendentalMode mode = TranscendentalMode::FAST;
+#else
+static TranscendentalMode mode = TranscendentalMode::EXACT;
+#endif
+
+// exp(x) = 2^n * exp(r), where n is the integer nearest x / ln(2) and |r| <= ln(2) / 2. ln(2) is
+// split in two so that n * LN2_HI is exact.
+static constexpr float EXP_MIN_INPUT = -87.0f;
+static constexpr float EXP_MAX_INPUT = 88.0f;
+static constexpr float LOG2E = 1.44269504f;
+static constexpr float LN2_HI = 0.693359375f;
+static constexpr float LN2_LO = -2.12194440e-4f;
+
+// Adding and then subtracting 1.5 * 2^23 rounds a float of magnitude below 2^22 to an integer.
+static constexpr float ROUNDING = 12582912.0f;
+
+// Cephes' minimax coefficients of (exp(r) - 1 - r) / r^2 on |r| <= ln(2) / 2, highest degree
+// first.
+static const float EXP_COEFFS[] = {1.3981999507e-3f, 8.3334519073e-3f, 4.1665795894e-2f,
+                                   1.6666665459e-1f, 5.0000001201e-1f};
+
+// The [7/6] Pade approximant of tanh, in x^2. Clamping the input where it is closest to 1 bounds
+// the error for large inputs.
+static constexpr float TANH_MAX_INPUT = 4.8f;
+static const float TANH_NUMERATOR[] = {1.0f, 378.0f, 17325.0f, 135135.0f};
+static const float TANH_DENOMINATOR[] = {28.0f, 3150.0f, 62370.0f, 135135.0f};
+
+// log(x) = e * ln(2) + log(1 + r), where 1 + r is x's mantissa scaled into [sqrt(0.5), sqrt(2)).
+// Cephes' coefficients of (log(1 + r) - r + r^2 / 2) / r^3, highest degree first.
+static constexpr float SQRT_HALF = 0.707106781f;
+static const float LOG_COEFFS[] = {7.0376836292e-2f,  -1.1514610310e-1f, 1.1676998740e-1f,
+                                   -1.2420140846e-1f, 1.4249322787e-1f,  -1.6668057665e-1f,
+                                   2.0000714765e-1f,  -2.4999993993e-1f, 3.3333331174e-1f};
+
+template <typename Packet, size_t N>
+static inline Packet polynomial(const Packet &x, const float (&coeffs)[N]) {
+  Packet result = pset1<Packet>(coeffs[0]);
+  for (size_t i = 1; i < N; i++) {
+    result = pmadd(result, x, pset1<Packet>(coeffs[i]));
+  }
+  return result;
+}
+
+template <typename Packet> static inline Packet fastExp(Packet x) {
+  typedef typename unpacket_traits<Packet>::integer_packet IntPacket;
+
+  x = pmax(pmin(x, pset1<Packet>(EXP_MAX_INPUT)), pset1<Packet>(EXP_MIN_INPUT));
+
+  const Packet rounding = pset1<Packet>(ROUNDING);
+  const Packet n = psub(padd(pmul(x, pset1<Packet>(LOG2E)), rounding), rounding);
+  Packet r = psub(x, pmul(n, pset1<Packet>(LN2_HI)));
+  r = psub(r, pmul(n, pset1<Packet>(LN2_LO)));
+
+  const Packet p = polynomial(r, EXP_COEFFS);
+  const Packet expR = padd(pmadd(pmul(p, r), r, r), pset1<Packet>(1.0f));
+
+  // n is within the normal exponents, so 2^n is just its biased exponent field.
+  const IntPacket exponent = padd(pcast<Packet, IntPacket>(n), pset1<IntPacket>(127));
+  return pmul(expR, preinterpret<Packet>(plogical_shift_left<23>(exponent)));
+}
+
+template <typename Packet> static inline Packet fastTanh(Packet x) {
+  const Packet maxInput = pset1<Packet>(TANH_MAX_INPUT);
+  x = pmax(pmin(x, maxInput), pnegate(maxInput));
+
+  const Packet z = pmul(x, x);
+  return pdiv(pmul(x, polynomial(z, TANH_NUMERATOR)), polynomial(z, TANH_DENOMINATOR));
+}
+
+template <typename Packet> static inline Packet fastLog(Packet x) {
+  typedef typename unpacket_traits<Packet>::integer_packet IntPacket;
+
+  const IntPacket bits = preinterpret<IntPacket>(x);
+  Packet e = pcast<IntPacket, Packet>(psub(plogical_shift_right<23>(bits), pset1<IntPacket>(126)));
+
+  // The mantissa in [0.5, 1), doubled below sqrt(0.5).
+  Packet m = por(pand(x, pset1frombits<Packet>(0x007FFFFFu)), pset1<Packet>(0.5f));
+  const Packet isSmall = pcmp_lt(m, pset1<Packet>(SQRT_HALF));
+  e = psub(e, pand(isSmall, pset1<Packet>(1.0f)));
+  const Packet r = psub(padd(m, pand(isSmall, m)), pset1<Packet>(1.0f));
+
+  const Packet r2 = pmul(r, r);
+  Packet y = pmul(pmul(r, r2), polynomial(r, LOG_COEFFS));
+  y = pmadd(e, pset1<Packet>(LN2_LO), y);
+  y = pmadd(r2, pset1<Packet>(-0.5f), y);
+  return pmadd(e, pset1<Packet>(LN2_HI), padd(r, y));
+}
+
+// Applies f to n contiguous floats. The tail that does not fill a packet goes through a padded
+// copy, so every element sees exactly the same arithmetic.
+template <typename F> static void applyContiguous(float *data, int n, F &&f) {
+  int i = 0;
+  for (; i + PACKET_SIZE <= n; i += PACKET_SIZE) {
+    pstoreu(data + i, f(ploadu<FloatPacket>(data + i)));
+  }
+
+  if (i < n) {
+    float tail[PACKET_SIZE] = {0.0f};
+    std::copy(data + i, data + n, tail);
+    pstoreu(tail, f(ploadu<FloatPacket>(tail)));
+    std::copy(tail, tail + (n - i), data + i);
+  }
+}
+
+template <typename F> static void apply(Eigen::Ref<EMatrix> &m, F &&f) {
+  if (m.outerStride() == m.innerSize()) {
+    applyContiguous(m.data(), m.size(), f);
+    return;
+  }
+
+  for (int i = 0; i < m.outerSize(); i++) {
+    applyContiguous(m.data() + i * m.outerStride(), m.innerSize(), f);
+  }
+}
+
+void math::SetTranscendentalMode(TranscendentalMode newMode) { mode = newMode; }
+
+TranscendentalMode math::GetTranscendentalMode(void) { return mode; }
+
+void math::Exp(Eigen::Ref<EMatrix> m) {
+  if (mode == TranscendentalMode::FAST) {
+    apply(m, fastExp<FloatPacket>);
+  } else {
+    m.array() = m.array().exp();
+  }
+}
+
+void math::Tanh(Eigen::Ref<EMatrix> m) {
+  if (mode == TranscendentalMode::FAST) {
+    apply(m, fastTanh<FloatPacket>);
+  } else {
+    m.array() = m.array().tanh();
+  }
+}
+
+void math::Log(Eigen::Ref<EMatrix> m) {
+  if (mode == TranscendentalMode::FAST) {
+    apply(m, fastLog<FloatPacket>);
+  } else {
+    m.array() = m.array().log();
+  }
+}
+
+// Written without selects so that it vectorises. Positive inputs come out exactly as they went in.
+template <typename Packet> static inline Packet fastElu(Packet x) {
+  const Packet zero = pzero(x);
+  return padd(pmax(x, zero), psub(fastExp(pmin(x, zero)), pset1<Packet>(1.0f)));
+}
+
+void math::Elu(Eigen::Ref<EMatrix> m) {
+  if (mode == TranscendentalMode::FAST) {
+    apply(m, fastElu<FloatPacket>);
+  } else {
+    m.array() = m.array().max(0.0f) + (m.array().min(0.0f).exp() - 1.0f);
+  }
+}
+
+// The column maxima and sums are taken one column at a time, so that no temporaries are allocated.
+void math::SoftmaxColumns(Eigen::Ref<EMatrix> m) {
+  for (int i = 0; i < m.cols(); i++) {
+    m.col(i).array() -= m.col(i).maxCoeff();
+  }
+  Exp(m);
+
+  for (int i = 0; i < m.cols(); i++) {
+    m.col(i) /= m.col(i).sum();
+  }
+}
+
+void math::SoftmaxColumns(Eigen::Ref<EMatrix> m, const EVector &temperatures) {
+  assert(temperatures.rows() == m.cols());
+
+  for (int i = 0; i < m.cols(); i++) {
+    m.col(i).array() = (m.col(i).array() - m.col(i).maxCoeff()) / temperatures(i);
+  }
+  Exp(m);
+
+  for (int i = 0; i < m.cols(); i++) {
+    m.col(i) /= m.col(i).sum();
+  }
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Math.hpp"
+
+namespace math {
+
+// exp, tanh and log over whole matrices at once. They are the inner cost of the activations and
+// softmaxes. Both modes are vectorised:
+// - EXACT uses Eigen's array functions, which are within a few ulps of the C library.
+// - FAST uses shorter approximations that skip special values. Exp has a relative error below
+//   3e-7 on [-87, 88] and saturates outside that range. Tanh has an absolute error below 8e-5.
+//   Log has a relative error below 1.2e-7, one ulp, for positive normal inputs.
+enum class TranscendentalMode {
+  EXACT,
+  FAST,
+};
+
+// Builds with FAST_TRANSCENDENTALS start in FAST mode, all others in EXACT. Change the mode only
+// while no other thread is using these functions.
+void SetTranscendentalMode(TranscendentalMode mode);
+TranscendentalMode GetTranscendentalMode(void);
+
+// Each replaces every element of m in place.
+void Exp(Eigen::Ref<EMatrix> m);
+void Tanh(Eigen::Ref<EMatrix> m);
+void Log(Eigen::Ref<EMatrix> m);
+
+// The ELU activation, max(x, 0) + exp(min(x, 0)) - 1, with exp in the current mode.
+void Elu(Eigen::Ref<EMatrix> m);
+
+// Replaces every column of m with its softmax, after dividing it by its temperature if given.
+void SoftmaxColumns(Eigen::Ref<EMatrix> m);
+void SoftmaxColumns(Eigen::Ref<EMatrix> m, const EVector &temperatures);
+}
@@ -1,30 +1,40 @@
 
 #pragma once
 
+#include "../math/Math.hpp"
+#include "../math/Transcendentals.hpp"
 #include "NetworkSpec.hpp"
 #include <cassert>
-#include <cmath>
 
 namespace neuralnetwork {
 
-inline float ActivationValue(LayerActivation func, float in) {
+// Applies the activation to every element of m, with math's vectorised transcendentals.
+inline void ApplyActivation(LayerActivation func, Eigen::Ref<EMatrix> m) {
+  auto a = m.array();
+
   switch (func) {
   case LayerActivation::TANH:
-    return tanhf(in);
+    math::Tanh(m);
+    return;
   case LayerActivation::LOGISTIC:
-    return 1.0f / (1.0f + expf(-in));
+    a = -a;
+    math::Exp(m);
+    a = 1.0f / (1.0f + a);
+    return;
   case LayerActivation::RELU:
-    return in > 0.0f ? in : 0.0f;
+    a = a.max(0.0f);
+    return;
   case LayerActivation::LEAKY_RELU:
-    return in > 0.0f ? in : (0.01f * in);
+    a = a.max(0.01f * a);
+    return;
   case LayerActivation::ELU:
-    return in > 0.0f ? in : (expf(in) - 1.0f);
+    math::Elu(m);
+    return;
   case LayerActivation::LINEAR:
   case LayerActivation::SOFTMAX:
-    return in;
+    return;
   }
   assert(false);
-  return in;
 }
 
 inline float ActivationDerivative(LayerActivation func, float in, float val) {
@@ -2,7 +2,9 @@
 #include "Network.hpp"
 #include "../math/Math.hpp"
 #include "../math/Tensor.hpp"
+#include "../math/Transcendentals.hpp"
 #include "Activations.hpp"
+#include "cpu/CpuNetwork.hpp"
 #include "cuda/CudaNetwork.hpp"
 
 #include <cassert>
@@ -14,41 +16,80 @@ using namespace neuralnetwork;
 struct Network::NetworkImpl {
   NetworkSpec spec;
   math::Tensor layerWeights;
-  uptr<cuda::CudaNetwork> cudaNetwork;
+  uptr<NetworkBackend> backend;
+  TrainingBatch packedSamples;
+  vector<EMatrix> processBuffers;
 
-  NetworkImpl(const NetworkSpec &spec) : spec(spec) {
+  NetworkImpl(const NetworkSpec &spec, NetworkBackendType backendType) : spec(spec) {
     assert(spec.numInputs > 0 && spec.numOutputs > 0);
     initialiseWeights();
-    initialiseCuda();
+    initialiseBackend(backendType);
   }
 
   EVector Process(const EVector &input) {
     assert(input.rows() == spec.numInputs);
+    return ProcessBatch(input).col(0);
+  }
+
+  EMatrix ProcessBatch(const EMatrix &inputs) {
+    assert(inputs.rows() == spec.numInputs && inputs.cols() > 0);
+
+    resizeProcessBuffers(inputs.cols());
+    processBuffers[0].topRows(spec.numInputs) = inputs;
 
-    EVector layerOutput = input;
     for (unsigned i = 0; i < layerWeights.NumLayers(); i++) {
-      LayerActivation func =
-          (i == layerWeights.NumLayers() - 1) ? spec.outputActivation : spec.hiddenActivation;
-      layerOutput = getLayerOutput(layerOutput, layerWeights(i), func);
-      layerOutput *= spec.nodeActivationRate;
+      processLayer(i);
+    }
+
+    return processBuffers.back().topRows(spec.numOutputs);
+  }
+
+  EMatrix ProcessSparse(const vector<unsigned> &activeInputs, unsigned activePerSample) {
+    assert(activePerSample > 0 && !activeInputs.empty());
+    assert(activeInputs.size() % activePerSample == 0);
+
+    const unsigned numSamples = activeInputs.size() / activePerSample;
+    resizeProcessBuffers(numSamples);
+
+    // For one-hot inputs the first layer's product is a sum of weight columns.
+    const EMatrix &inputWeights = layerWeights(0);
+    auto z = processBuffers[1].topRows(inputWeights.rows());
+    for (unsigned c = 0; c < numSamples; c++) {
+      z.col(c) = inputWeights.col(spec.numInputs);
+
+      for (unsigned k = 0; k < activePerSample; k++) {
+        unsigned index = activeInputs[c * activePerSample + k];
+        if (index != NO_ACTIVE_INPUT) {
+          assert(index < spec.numInputs);
+          z.col(c) += inputWeights.col(index);
+        }
+      }
+    }
+    activateLayer(0, z);
+
+    for (unsigned i = 1; i < layerWeights.NumLayers(); i++) {
+      processLayer(i);
     }
 
-    return layerOutput;
+    return processBuffers.back().topRows(spec.numOutputs);
   }
 
   void Refresh(void) {
-    vector<math::MatrixView> weightViews;
+    vector<ERowMatrix> scratch;
+    vector<math::MatrixView> weightViews = getWeightViews(scratch);
+    backend->GetWeights(weightViews);
+
     for (unsigned i = 0; i < layerWeights.NumLayers(); i++) {
-      weightViews.push_back(math::GetMatrixView(layerWeights(i)));
+      if (weightViews[i].data != layerWeights(i).data()) {
+        layerWeights(i) = scratch[i];
+      }
     }
-    cudaNetwork->GetWeights(weightViews);
   }
 
   void Update(const SamplesProvider &samplesProvider) {
     assert(samplesProvider.NumSamples() <= spec.maxBatchSize);
 
-    EMatrix input(samplesProvider.NumSamples(), spec.numInputs);
-    EMatrix output(samplesProvider.NumSamples(), spec.numOutputs);
+    packedSamples.ResizeDense(samplesProvider.NumSamples(), spec.numInputs, spec.numOutputs);
 
     for (unsigned i = 0; i < samplesProvider.NumSamples(); i++) {
       const TrainingSample &sample = samplesProvider[i];
@@ -56,41 +97,67 @@ struct Network::NetworkImpl {
       assert(sample.input.cols() == 1 && sample.input.rows() == spec.numInputs);
       assert(sample.expectedOutput.cols() == 1 && sample.expectedOutput.rows() == spec.numOutputs);
 
-      for (unsigned j = 0; j < sample.input.rows(); j++) {
-        input(i, j) = sample.input(j);
-      }
+      packedSamples.inputs.row(i) = sample.input.transpose();
+      packedSamples.outputs.row(i) = sample.expectedOutput.transpose();
+    }
 
-      for (unsigned j = 0; j < sample.expectedOutput.rows(); j++) {
-        output(i, j) = sample.expectedOutput(j);
-      }
+    Update(packedSamples);
+  }
+
+  void Update(const TrainingBatch &batch) {
+    assert(batch.Size() > 0 && batch.Size() <= spec.maxBatchSize);
+    assert(batch.outputs.cols() == spec.numOutputs);
+
+    math::MatrixView batchOutputs = readOnlyView(batch.outputs);
+    if (batch.IsSparse()) {
+      assert(batch.activeInputs.size() == batch.Size() * batch.activePerSample);
+      backend->TrainSparse(batch.activeInputs, batch.activePerSample, batchOutputs);
+    } else {
+      assert(batch.inputs.rows() == batch.Size() && batch.inputs.cols() == spec.numInputs);
+      backend->Train(readOnlyView(batch.inputs), batchOutputs);
     }
+  }
 
-    math::MatrixView batchInputs = math::GetMatrixView(input);
-    math::MatrixView batchOutputs = math::GetMatrixView(output);
-    cudaNetwork->Train(batchInputs, batchOutputs);
+  // The backends only read the batches they are given.
+  math::MatrixView readOnlyView(const ERowMatrix &m) const {
+    return math::GetMatrixView(const_cast<ERowMatrix &>(m));
   }
 
-  EVector getLayerOutput(const EVector &prevLayer, const EMatrix &layerWeights,
-                         LayerActivation afunc) const {
-    assert(prevLayer.rows() == layerWeights.cols() - 1);
+  void processLayer(unsigned index) {
+    auto z = processBuffers[index + 1].topRows(layerWeights(index).rows());
+    z.noalias() = layerWeights(index) * processBuffers[index];
+    activateLayer(index, z);
+  }
 
-    EVector z = layerWeights * getInputWithBias(prevLayer);
-    if (afunc == LayerActivation::SOFTMAX) {
-      z = softmaxActivations(z);
+  void activateLayer(unsigned index, Eigen::Ref<EMatrix> z) const {
+    if (index == layerWeights.NumLayers() - 1 &&
+        spec.outputActivation == LayerActivation::SOFTMAX) {
+      math::SoftmaxColumns(z);
     } else {
-      for (unsigned i = 0; i < z.rows(); i++) {
-        z(i) = ActivationValue(afunc, z(i));
-      }
+      LayerActivation func = index == layerWeights.NumLayers() - 1 ? spec.outputActivation
+                                                                   : spec.hiddenActivation;
+      ApplyActivation(func, z);
     }
 
-    return z;
+    z *= spec.nodeActivationRate;
   }
 
-  EVector getInputWithBias(const EVector &noBiasInput) const {
-    EVector result(noBiasInput.rows() + 1);
-    result(noBiasInput.rows()) = 1.0f;
-    result.topRightCorner(noBiasInput.rows(), 1) = noBiasInput;
-    return result;
+  // Every layer's outputs for the current batch, a sample per column, with a row of ones under
+  // them for the next layer's bias. Reallocated only when the batch size changes.
+  void resizeProcessBuffers(unsigned numSamples) {
+    if (processBuffers.empty()) {
+      processBuffers.emplace_back(spec.numInputs + 1, 0);
+      for (unsigned i = 0; i < layerWeights.NumLayers(); i++) {
+        processBuffers.emplace_back(layerWeights(i).rows() + 1, 0);
+      }
+    }
+
+    for (auto &buffer : processBuffers) {
+      if (buffer.cols() != numSamples) {
+        buffer.resize(buffer.rows(), numSamples);
+        buffer.bottomRows(1).fill(1.0f);
+      }
+    }
   }
 
   void initialiseWeights(void) {
@@ -125,43 +192,45 @@ struct Network::NetworkImpl {
     return result;
   }
 
-  void initialiseCuda(void) {
-    cudaNetwork = make_unique<cuda::CudaNetwork>(spec);
-
-    vector<math::MatrixView> weights;
-    for (unsigned i = 0; i < layerWeights.NumLayers(); i++) {
-      weights.push_back(math::GetMatrixView(layerWeights(i)));
+  void initialiseBackend(NetworkBackendType backendType) {
+    switch (backendType) {
+    case NetworkBackendType::CUDA:
+      backend = make_unique<cuda::CudaNetwork>(spec);
+      break;
+    case NetworkBackendType::CPU:
+      backend = make_unique<cpu::CpuNetwork>(spec);
+      break;
     }
+    assert(backend != nullptr);
 
-    cudaNetwork->SetWeights(weights);
+    vector<ERowMatrix> scratch;
+    backend->SetWeights(getWeightViews(scratch));
   }
 
-  EVector softmaxActivations(const EVector &in) const {
-    assert(in.rows() > 0);
-    EVector result(in.rows());
-
-    float maxVal = in(0);
-    for (int r = 0; r < in.rows(); r++) {
-      maxVal = fmax(maxVal, in(r));
-    }
-
-    float sum = 0.0f;
-    for (int i = 0; i < in.rows(); i++) {
-      result(i) = expf(in(i)-maxVal);
-      sum += result(i);
-    }
+  // The backends take row major weights. These view layerWeights in place when EMatrix is row
+  // major, and copies of it in scratch otherwise.
+  vector<math::MatrixView> getWeightViews(vector<ERowMatrix> &scratch) {
+    scratch.resize(layerWeights.NumLayers());
 
-    for (int i = 0; i < result.rows(); i++) {
-      result(i) /= sum;
+    vector<math::MatrixView> result;
+    for (unsigned i = 0; i < layerWeights.NumLayers(); i++) {
+      result.push_back(math::RowMajorView(layerWeights(i), scratch[i]));
     }
-
     return result;
   }
 };
 
-Network::Network(const NetworkSpec &spec) : impl(new NetworkImpl(spec)) {}
+Network::Network(const NetworkSpec &spec, NetworkBackendType backendType)
+    : impl(new NetworkImpl(spec, backendType)) {}
 Network::~Network() = default;
 
 EVector Network::Process(const EVector &input) { return impl->Process(input); }
+EMatrix Network::ProcessBatch(const EMatrix &inputs) { return impl->ProcessBatch(inputs); }
+
+EMatrix Network::ProcessSparse(const vector<unsigned> &activeInputs, unsigned activePerSample) {
+  return impl->ProcessSparse(activeInputs, activePerSample);
+}
+
 void Network::Refresh(void) { impl->Refresh(); }
 void Network::Update(const SamplesProvider &samplesProvider) { impl->Update(samplesProvider); }
+void Network::Update(const TrainingBatch &batch) { impl->Update(batch); }
@@ -3,20 +3,30 @@
 
 #include "../common/Common.hpp"
 #include "../math/Math.hpp"
+#include "NetworkBackend.hpp"
 #include "NetworkSpec.hpp"
 #include "SamplesProvider.hpp"
+#include "TrainingBatch.hpp"
 #include <vector>
 
 namespace neuralnetwork {
 
 class Network {
 public:
-  Network(const NetworkSpec &spec);
+  Network(const NetworkSpec &spec, NetworkBackendType backendType = NetworkBackendType::CUDA);
   virtual ~Network();
 
   EVector Process(const EVector &input); // TODO: make this const?
+
+  // Processes a batch of inputs, one per column.
+  EMatrix ProcessBatch(const EMatrix &inputs);
+
+  // As above for one-hot inputs given by the indices of their ones, activePerSample per sample
+  // (NO_ACTIVE_INPUT for none), the way TrainingBatch holds sparse inputs.
+  EMatrix ProcessSparse(const vector<unsigned> &activeInputs, unsigned activePerSample);
   void Refresh(void);
   void Update(const SamplesProvider &samplesProvider);
+  void Update(const TrainingBatch &batch);
 
 private:
   // Non-copyable
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "../math/MatrixView.hpp"
+#include <vector>
+
+namespace neuralnetwork {
+
+enum class NetworkBackendType { CUDA, CPU };
+
+// Marks an unused slot of a sparse input.
+static constexpr unsigned NO_ACTIVE_INPUT = 0xFFFFFFFFu;
+
+// Holds the training copy of a feedforward network's weights and runs the forward pass, backward
+// pass and Adam step for each batch. Every matrix crossing the interface is row major, with a
+// layer's bias weights in its last column and one sample per batch row.
+class NetworkBackend {
+public:
+  virtual ~NetworkBackend() = default;
+
+  virtual void SetWeights(const std::vector<math::MatrixView> &weights) = 0;
+  virtual void GetWeights(std::vector<math::MatrixView> &outWeights) = 0;
+
+  virtual void Train(const math::MatrixView &batchInputs, const math::MatrixView &batchOutputs) = 0;
+
+  // Trains on inputs that are zero apart from activePerSample ones per sample, whose indices are
+  // given sample by sample in activeInputs.
+  virtual void TrainSparse(const std::vector<unsigned> &activeInputs, unsigned activePerSample,
+                           const math::MatrixView &batchOutputs) = 0;
+};
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "../common/Common.hpp"
+#include "../math/Math.hpp"
+#include "NetworkBackend.hpp"
+#include <cassert>
+#include <vector>
+
+namespace neuralnetwork {
+
+// A batch packed the way the backends read it, one sample per row, so it can be handed over
+// without copying. The inputs are either dense, or sparse one-hot inputs given by the indices of
+// their ones, activePerSample per sample (NO_ACTIVE_INPUT for none), as n-gram inputs are.
+// A batch is meant to be refilled in place every iteration.
+struct TrainingBatch {
+  ERowMatrix inputs;
+  vector<unsigned> activeInputs;
+  unsigned activePerSample;
+
+  ERowMatrix outputs;
+
+  TrainingBatch() : activePerSample(0) {}
+
+  void ResizeDense(unsigned batchSize, unsigned numInputs, unsigned numOutputs) {
+    inputs.resize(batchSize, numInputs);
+    activeInputs.clear();
+    activePerSample = 0;
+    outputs.resize(batchSize, numOutputs);
+  }
+
+  void ResizeSparse(unsigned batchSize, unsigned activePerSample, unsigned numOutputs) {
+    assert(activePerSample > 0);
+    inputs.resize(0, 0);
+    activeInputs.resize(batchSize * activePerSample);
+    this->activePerSample = activePerSample;
+    outputs.resize(batchSize, numOutputs);
+  }
+
+  unsigned Size(void) const { return outputs.rows(); }
+  bool IsSparse(void) const { return activePerSample > 0; }
+};
+}
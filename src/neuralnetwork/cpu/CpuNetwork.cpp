@@ -0,0 +1,299 @@
+
+#include "CpuNetwork.hpp"
+#include "../../common/Common.hpp"
+#include "../../math/Math.hpp"
+#include "../../math/Transcendentals.hpp"
+#include "../Activations.hpp"
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+
+#include <cassert>
+#include <cmath>
+#include <random>
+
+using namespace neuralnetwork;
+using namespace neuralnetwork::cpu;
+
+// ADAM trainer parameters, the same as the CUDA trainer's.
+static constexpr float adamBeta1 = 0.9f;
+static constexpr float adamBeta2 = 0.999f;
+static constexpr float adamEpsilon = 10e-8;
+static constexpr float adamLearnRate = 0.001f;
+
+// Samples per forward/backward task and weight rows per gradient task.
+static constexpr unsigned BATCH_BLOCK = 32;
+static constexpr unsigned ROW_BLOCK = 16;
+
+namespace {
+
+struct RowBlock {
+  unsigned layer;
+  unsigned start;
+  unsigned size;
+
+  RowBlock(unsigned layer, unsigned start, unsigned size)
+      : layer(layer), start(start), size(size) {}
+};
+}
+
+struct CpuNetwork::CpuNetworkImpl {
+  NetworkSpec spec;
+
+  // Weight i maps the outputs of layer i, with a trailing bias row of ones, to layer i + 1.
+  // Batches are stored a sample per column, allocated for the largest batch up front.
+  vector<EMatrix> weights;
+  vector<EMatrix> layerOutputs;
+  vector<EMatrix> layerDerivatives;
+  vector<EMatrix> layerDeltas;
+  EMatrix targets;
+
+  vector<EMatrix> gradients;
+  vector<EMatrix> adamMomentum;
+  vector<EMatrix> adamRMS;
+
+  vector<RowBlock> rowBlocks;
+  std::mt19937 rng;
+  unsigned dropoutKey;
+
+  // Set while training on a sparse batch, whose inputs are never expanded.
+  const vector<unsigned> *activeInputs;
+  unsigned activePerSample;
+
+  CpuNetworkImpl(const NetworkSpec &spec)
+      : spec(spec), rng(1337), dropoutKey(0), activeInputs(nullptr), activePerSample(0) {
+    assert(spec.numInputs > 0 && spec.numOutputs > 0 && spec.maxBatchSize > 0);
+    assert(spec.hiddenActivation != LayerActivation::SOFTMAX);
+
+    vector<unsigned> layerSizes = spec.hiddenLayers;
+    layerSizes.push_back(spec.numOutputs);
+
+    layerOutputs.push_back(newLayerOutputs(spec.numInputs));
+    for (unsigned i = 0; i < layerSizes.size(); i++) {
+      unsigned inputSize = (i == 0 ? spec.numInputs : layerSizes[i - 1]) + 1;
+
+      weights.push_back(EMatrix::Zero(layerSizes[i], inputSize));
+      gradients.push_back(EMatrix::Zero(layerSizes[i], inputSize));
+      adamMomentum.push_back(EMatrix::Zero(layerSizes[i], inputSize));
+      adamRMS.push_back(EMatrix::Zero(layerSizes[i], inputSize));
+
+      layerOutputs.push_back(newLayerOutputs(layerSizes[i]));
+      layerDerivatives.push_back(EMatrix::Zero(layerSizes[i], spec.maxBatchSize));
+      layerDeltas.push_back(EMatrix::Zero(layerSizes[i], spec.maxBatchSize));
+
+      for (unsigned r = 0; r < layerSizes[i]; r += ROW_BLOCK) {
+        rowBlocks.emplace_back(i, r, min(ROW_BLOCK, layerSizes[i] - r));
+      }
+    }
+
+    targets = EMatrix::Zero(spec.numOutputs, spec.maxBatchSize);
+  }
+
+  void SetWeights(const vector<math::MatrixView> &newWeights) {
+    assert(newWeights.size() == weights.size());
+
+    for (unsigned i = 0; i < newWeights.size(); i++) {
+      assert(newWeights[i].rows == weights[i].rows());
+      assert(newWeights[i].cols == weights[i].cols());
+      weights[i] = math::MapMatrixView(newWeights[i]);
+    }
+  }
+
+  void GetWeights(vector<math::MatrixView> &outWeights) {
+    assert(outWeights.size() == weights.size());
+
+    for (unsigned i = 0; i < outWeights.size(); i++) {
+      assert(outWeights[i].rows == weights[i].rows());
+      assert(outWeights[i].cols == weights[i].cols());
+      math::MapMatrixView(outWeights[i]) = weights[i];
+    }
+  }
+
+  void Train(const math::MatrixView &batchInputs, const math::MatrixView &batchOutputs) {
+    assert(batchInputs.rows == batchOutputs.rows);
+    assert(batchInputs.cols == spec.numInputs);
+
+    train(&batchInputs, batchOutputs);
+  }
+
+  void TrainSparse(const vector<unsigned> &activeInputs, unsigned activePerSample,
+                   const math::MatrixView &batchOutputs) {
+    assert(activePerSample > 0);
+    assert(activeInputs.size() == batchOutputs.rows * activePerSample);
+
+    this->activeInputs = &activeInputs;
+    this->activePerSample = activePerSample;
+    train(nullptr, batchOutputs);
+    this->activeInputs = nullptr;
+  }
+
+private:
+  void train(const math::MatrixView *batchInputs, const math::MatrixView &batchOutputs) {
+    assert(batchOutputs.rows > 0 && batchOutputs.rows <= spec.maxBatchSize);
+    assert(batchOutputs.cols == spec.numOutputs);
+
+    const unsigned batchSize = batchOutputs.rows;
+    const unsigned numBlocks = (batchSize + BATCH_BLOCK - 1) / BATCH_BLOCK;
+    dropoutKey = rng();
+
+    // The samples are independent until the gradient, so each block goes forward and back alone.
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, numBlocks),
+                      [this, batchInputs, &batchOutputs,
+                       batchSize](const tbb::blocked_range<unsigned> &r) {
+                        for (unsigned b = r.begin(); b != r.end(); b++) {
+                          unsigned start = b * BATCH_BLOCK;
+                          unsigned size = min(BATCH_BLOCK, batchSize - start);
+
+                          loadBlock(batchInputs, batchOutputs, start, size);
+                          forwardBlock(start, size);
+                          backwardBlock(start, size);
+                        }
+                      });
+
+    tbb::parallel_for(tbb::blocked_range<unsigned>(0, rowBlocks.size()),
+                      [this, batchSize](const tbb::blocked_range<unsigned> &r) {
+                        for (unsigned i = r.begin(); i != r.end(); i++) {
+                          updateRows(rowBlocks[i], batchSize);
+                        }
+                      });
+  }
+
+  EMatrix newLayerOutputs(unsigned layerSize) const {
+    EMatrix result = EMatrix::Zero(layerSize + 1, spec.maxBatchSize);
+    result.bottomRows(1).fill(1.0f); // the bias input of the next layer.
+    return result;
+  }
+
+  void loadBlock(const math::MatrixView *batchInputs, const math::MatrixView &batchOutputs,
+                 unsigned start, unsigned size) {
+    if (batchInputs != nullptr) {
+      layerOutputs[0].block(0, start, spec.numInputs, size) =
+          math::MapMatrixView(*batchInputs).middleRows(start, size).transpose();
+    }
+    targets.middleCols(start, size) =
+        math::MapMatrixView(batchOutputs).middleRows(start, size).transpose();
+  }
+
+  void forwardBlock(unsigned start, unsigned size) {
+    for (unsigned i = 0; i < weights.size(); i++) {
+      const bool isOutput = i == weights.size() - 1;
+      const unsigned layerSize = weights[i].rows();
+
+      auto z = layerOutputs[i + 1].block(0, start, layerSize, size);
+      if (i == 0 && activeInputs != nullptr) {
+        sparseInputProduct(start, size, z);
+      } else {
+        z.noalias() = weights[i] * layerOutputs[i].middleCols(start, size);
+      }
+
+      if (isOutput && spec.outputActivation == LayerActivation::SOFTMAX) {
+        math::SoftmaxColumns(z);
+        continue;
+      }
+
+      LayerActivation func = isOutput ? spec.outputActivation : spec.hiddenActivation;
+      const bool dropout = !isOutput && spec.nodeActivationRate < 1.0f;
+      const unsigned key = dropoutKey ^ (i * 0x9E3779B9u);
+
+      // The derivatives start as the layer's inputs, which they are computed from.
+      auto d = layerDerivatives[i].middleCols(start, size);
+      d = z;
+      ApplyActivation(func, z);
+
+      for (unsigned c = 0; c < size; c++) {
+        for (unsigned r = 0; r < layerSize; r++) {
+          if (dropout &&
+              math::HashUnitRand(key, r + (start + c) * layerSize) >= spec.nodeActivationRate) {
+            z(r, c) = 0.0f;
+            d(r, c) = 0.0f;
+          } else {
+            d(r, c) = ActivationDerivative(func, d(r, c), z(r, c));
+          }
+        }
+      }
+    }
+  }
+
+  // The first layer's product for one-hot inputs is a sum of weight columns.
+  void sparseInputProduct(unsigned start, unsigned size, Eigen::Block<EMatrix> &out) {
+    for (unsigned c = 0; c < size; c++) {
+      out.col(c) = weights[0].col(spec.numInputs);
+
+      for (unsigned k = 0; k < activePerSample; k++) {
+        unsigned index = (*activeInputs)[(start + c) * activePerSample + k];
+        if (index != NO_ACTIVE_INPUT) {
+          assert(index < spec.numInputs);
+          out.col(c) += weights[0].col(index);
+        }
+      }
+    }
+  }
+
+  void backwardBlock(unsigned start, unsigned size) {
+    const unsigned last = weights.size() - 1;
+    layerDeltas[last].middleCols(start, size) =
+        layerOutputs[last + 1].block(0, start, spec.numOutputs, size) -
+        targets.middleCols(start, size);
+
+    for (int i = last - 1; i >= 0; i--) {
+      auto delta = layerDeltas[i].middleCols(start, size);
+
+      // The bias column feeds nothing back.
+      delta.noalias() = weights[i + 1].leftCols(delta.rows()).transpose() *
+                        layerDeltas[i + 1].middleCols(start, size);
+      delta.array() *= layerDerivatives[i].middleCols(start, size).array();
+    }
+  }
+
+  // The batch mean gradient of a block of weight rows, applied with Adam straight away.
+  void updateRows(const RowBlock &rb, unsigned batchSize) {
+    auto g = gradients[rb.layer].middleRows(rb.start, rb.size);
+    auto delta = layerDeltas[rb.layer].block(rb.start, 0, rb.size, batchSize);
+
+    if (rb.layer == 0 && activeInputs != nullptr) {
+      g.setZero();
+      for (unsigned s = 0; s < batchSize; s++) {
+        g.col(spec.numInputs) += delta.col(s);
+
+        for (unsigned k = 0; k < activePerSample; k++) {
+          unsigned index = (*activeInputs)[s * activePerSample + k];
+          if (index != NO_ACTIVE_INPUT) {
+            g.col(index) += delta.col(s);
+          }
+        }
+      }
+    } else {
+      g.noalias() = delta * layerOutputs[rb.layer].leftCols(batchSize).transpose();
+    }
+    g *= 1.0f / batchSize;
+
+    auto m = adamMomentum[rb.layer].middleRows(rb.start, rb.size);
+    auto v = adamRMS[rb.layer].middleRows(rb.start, rb.size);
+    m.array() = m.array() * adamBeta1 + g.array() * (1.0f - adamBeta1);
+    v.array() = v.array() * adamBeta2 + g.array().square() * (1.0f - adamBeta2);
+
+    weights[rb.layer].middleRows(rb.start, rb.size).array() -=
+        adamLearnRate * (m.array() / (1.0f - adamBeta1)) /
+        (v.array() / (1.0f - adamBeta2) + adamEpsilon).sqrt();
+  }
+};
+
+CpuNetwork::CpuNetwork(const NetworkSpec &spec) : impl(new CpuNetworkImpl(spec)) {}
+CpuNetwork::~CpuNetwork() = default;
+
+void CpuNetwork::SetWeights(const std::vector<math::MatrixView> &weights) {
+  impl->SetWeights(weights);
+}
+
+void CpuNetwork::GetWeights(std::vector<math::MatrixView> &outWeights) {
+  impl->GetWeights(outWeights);
+}
+
+void CpuNetwork::Train(const math::MatrixView &batchInputs, const math::MatrixView &batchOutputs) {
+  impl->Train(batchInputs, batchOutputs);
+}
+
+void CpuNetwork::TrainSparse(const std::vector<unsigned> &activeInputs, unsigned activePerSample,
+                             const math::MatrixView &batchOutputs) {
+  impl->TrainSparse(activeInputs, activePerSample, batchOutputs);
+}
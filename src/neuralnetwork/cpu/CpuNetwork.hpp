@@ -0,0 +1,30 @@
+#pragma once
+
+#include "../NetworkBackend.hpp"
+#include "../NetworkSpec.hpp"
+#include <memory>
+
+namespace neuralnetwork {
+namespace cpu {
+
+// Trains the network on the host with TBB. Each task runs the forward and backward pass for a
+// block of the batch, applying the activations while the block's products are still in cache,
+// then the gradient and Adam step are computed together over blocks of weight rows.
+class CpuNetwork : public NetworkBackend {
+public:
+  CpuNetwork(const NetworkSpec &spec);
+  ~CpuNetwork();
+
+  void SetWeights(const std::vector<math::MatrixView> &weights) override;
+  void GetWeights(std::vector<math::MatrixView> &outWeights) override;
+
+  void Train(const math::MatrixView &batchInputs, const math::MatrixView &batchOutputs) override;
+  void TrainSparse(const std::vector<unsigned> &activeInputs, unsigned activePerSample,
+                   const math::MatrixView &batchOutputs) override;
+
+private:
+  struct CpuNetworkImpl;
+  std::unique_ptr<CpuNetworkImpl> impl;
+};
+}
+}
@@ -136,6 +136,9 @@ struct CudaNetwork::CudaNetworkImpl {
 
   LayerWeights d_transposeScratch;
 
+  // Host buffer sparse batches are expanded into before uploading.
+  vector<float> denseInputs;
+
   // TODO: this stuff should go into a separate file. Trainer code/variables should be
   // separate from network code.
   vector<LayerWeights> d_adamMomentum;
@@ -222,6 +225,27 @@ struct CudaNetwork::CudaNetworkImpl {
     }
   }
 
+  void TrainSparse(const std::vector<unsigned> &activeInputs, unsigned activePerSample,
+                   const math::MatrixView &batchOutputs) {
+    assert(activeInputs.size() == batchOutputs.rows * activePerSample);
+
+    const unsigned numInputs = networkSpec.numInputs;
+    denseInputs.assign(batchOutputs.rows * numInputs, 0.0f);
+
+    for (unsigned i = 0; i < activeInputs.size(); i++) {
+      if (activeInputs[i] != NO_ACTIVE_INPUT) {
+        assert(activeInputs[i] < numInputs);
+        denseInputs[(i / activePerSample) * numInputs + activeInputs[i]] = 1.0f;
+      }
+    }
+
+    math::MatrixView batchInputs;
+    batchInputs.rows = batchOutputs.rows;
+    batchInputs.cols = numInputs;
+    batchInputs.data = denseInputs.data();
+    Train(batchInputs, batchOutputs);
+  }
+
 private:
   void uploadSamplesBatch(const math::MatrixView &batchInputs,
                           const math::MatrixView &batchOutputs) {
@@ -421,3 +445,8 @@ void CudaNetwork::GetWeights(std::vector<math::MatrixView> &outWeights) {
 void CudaNetwork::Train(const math::MatrixView &batchInputs, const math::MatrixView &batchOutputs) {
   impl->Train(batchInputs, batchOutputs);
 }
+
+void CudaNetwork::TrainSparse(const std::vector<unsigned> &activeInputs, unsigned activePerSample,
+                              const math::MatrixView &batchOutputs) {
+  impl->TrainSparse(activeInputs, activePerSample, batchOutputs);
+}
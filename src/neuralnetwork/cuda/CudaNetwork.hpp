@@ -2,21 +2,24 @@
 #pragma once
 
 #include "../../math/MatrixView.hpp"
+#include "../NetworkBackend.hpp"
 #include "../NetworkSpec.hpp"
 #include <memory>
 
 namespace neuralnetwork {
 namespace cuda {
 
-class CudaNetwork {
+class CudaNetwork : public NetworkBackend {
 public:
   CudaNetwork(const NetworkSpec &spec);
   ~CudaNetwork();
 
-  void SetWeights(const std::vector<math::MatrixView> &weights);
-  void GetWeights(std::vector<math::MatrixView> &outWeights);
+  void SetWeights(const std::vector<math::MatrixView> &weights) override;
+  void GetWeights(std::vector<math::MatrixView> &outWeights) override;
 
-  void Train(const math::MatrixView &batchInputs, const math::MatrixView &batchOutputs);
+  void Train(const math::MatrixView &batchInputs, const math::MatrixView &batchOutputs) override;
+  void TrainSparse(const std::vector<unsigned> &activeInputs, unsigned activePerSample,
+                   const math::MatrixView &batchOutputs) override;
 
 private:
   struct CudaNetworkImpl;
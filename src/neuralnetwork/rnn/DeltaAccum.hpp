@@ -63,6 +63,14 @@ struct DeltaAccum {
     return allDeltaAccum.front();
   }
 
+  void ReleaseDeltas(int timestamp) {
+    allDeltaAccum.erase(remove_if(allDeltaAccum.begin(), allDeltaAccum.end(),
+                                  [timestamp](const LayerAccum &da) {
+                                    return da.timestamp == timestamp;
+                                  }),
+                        allDeltaAccum.end());
+  }
+
   void DebugPrint(void) {
     cout << "num deltas accumulated: " << allDeltaAccum.size() << endl;
     for (const auto &wa : allDeltaAccum) {
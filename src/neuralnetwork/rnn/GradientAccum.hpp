@@ -3,6 +3,7 @@
 #include "../../common/Common.hpp"
 #include "../../common/Maybe.hpp"
 #include "../../math/Math.hpp"
+#include "../../math/SmallGemm.hpp"
 #include "Layer.hpp"
 #include "RNNSpec.hpp"
 #include <vector>
@@ -14,15 +15,22 @@ struct ConnectionAccum {
   EMatrix accumGradient;
   unsigned samples;
 
-  ConnectionAccum(const EMatrix &gradient) : accumGradient(gradient), samples(1) {}
+  ConnectionAccum(int rows, int cols) : accumGradient(EMatrix::Zero(rows, cols)), samples(0) {}
 
   EMatrix GetGradient(void) const {
     assert(samples > 0);
     return accumGradient * (1.0f / static_cast<float>(samples));
   }
 
-  void AccumGradient(const EMatrix &gradient) {
-    accumGradient += gradient;
+  // Adds delta * [input; 1]^T, the gradient of weights applied to an input with a bias row. Only
+  // the blocks that packed, the weights without their bias column, stores are needed.
+  void AccumGradient(const math::PackedMatrix &packed, const EMatrix &delta,
+                     const EMatrix &input) {
+    const int n = input.rows();
+    assert(accumGradient.rows() == delta.rows() && accumGradient.cols() == n + 1);
+
+    math::AddProductTransB(delta, input, packed, accumGradient.leftCols(n));
+    accumGradient.col(n) += delta.rowwise().sum();
     samples++;
   }
 };
@@ -30,15 +38,17 @@ struct ConnectionAccum {
 struct GradientAccum {
   vector<pair<LayerConnection, ConnectionAccum>> allWeightsAccum;
 
-  void IncrementWeights(const LayerConnection &connection, const EMatrix &gradient) {
+  void IncrementWeights(const LayerConnection &connection, const math::PackedMatrix &packed,
+                        const EMatrix &delta, const EMatrix &input) {
     for (auto &wa : allWeightsAccum) {
       if (wa.first == connection) {
-        wa.second.AccumGradient(gradient);
+        wa.second.AccumGradient(packed, delta, input);
         return;
       }
     }
 
-    allWeightsAccum.emplace_back(connection, ConnectionAccum(gradient));
+    allWeightsAccum.emplace_back(connection, ConnectionAccum(delta.rows(), input.rows() + 1));
+    allWeightsAccum.back().second.AccumGradient(packed, delta, input);
   }
 
   Maybe<EMatrix> GetGradient(const LayerConnection &connection) {
@@ -0,0 +1,74 @@
+
+#include "InferenceModel.hpp"
+#include <cassert>
+
+using namespace neuralnetwork;
+using namespace neuralnetwork::rnn;
+
+static int findLayerIndex(const vector<InferenceLayer> &layers, unsigned layerId) {
+  for (unsigned i = 0; i < layers.size(); i++) {
+    if (layers[i].layerId == layerId) {
+      return i;
+    }
+  }
+
+  assert(false);
+  return -1;
+}
+
+InferenceModel::InferenceModel(const RNN &network)
+    : InferenceModel(network.GetSpec(), network.GetWeights()) {}
+
+InferenceModel::InferenceModel(const RNNSpec &spec, const math::Tensor &weights)
+    : spec(spec), outputIndex(0) {
+  for (const auto &ls : spec.layers) {
+    layers.emplace_back(ls.uid, ls.isOutput ? spec.outputActivation : spec.hiddenActivation,
+                        ls.numNodes, ls.isOutput);
+    if (ls.isOutput) {
+      outputIndex = layers.size() - 1;
+    }
+  }
+
+  // The weights tensor follows the RNN's ordering: layers in spec order, and for each layer its
+  // incoming connections in spec order.
+  unsigned weightIndex = 0;
+  for (auto &layer : layers) {
+    for (const auto &lc : spec.connections) {
+      if (lc.dstLayerId != layer.layerId) {
+        continue;
+      }
+
+      const EMatrix &w = weights(weightIndex++);
+      assert(w.rows() == layer.numNodes);
+
+      int srcIndex = lc.srcLayerId == 0 ? -1 : findLayerIndex(layers, lc.srcLayerId);
+      EMatrix noBiasWeights = w.leftCols(w.cols() - 1);
+      if (srcIndex >= 0 && lc.timeOffset == 0) {
+        noBiasWeights *= spec.nodeActivationRate;
+      }
+      if (srcIndex >= 0 && lc.timeOffset == 1) {
+        layers[srcIndex].isRecurrentSource = true;
+      }
+
+      layer.incoming.emplace_back(lc, srcIndex, noBiasWeights, w.col(w.cols() - 1));
+    }
+  }
+
+  assert(weightIndex == weights.NumLayers());
+  assert(layers[outputIndex].isOutput);
+}
+
+InferenceModel InferenceModel::Quantised(void) const {
+  InferenceModel result(*this);
+  for (auto &layer : result.layers) {
+    for (auto &connection : layer.incoming) {
+      if (!connection.isQuantised) {
+        connection.quantisedWeights = math::QuantisedMatrix::Quantise(connection.weights);
+        connection.weights.resize(0, 0);
+        connection.packedWeights = math::PackedMatrix();
+        connection.isQuantised = true;
+      }
+    }
+  }
+  return result;
+}
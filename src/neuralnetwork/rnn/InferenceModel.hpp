@@ -0,0 +1,63 @@
+#pragma once
+
+#include "../../common/Common.hpp"
+#include "../../math/Math.hpp"
+#include "../../math/QuantisedMatrix.hpp"
+#include "../../math/SmallGemm.hpp"
+#include "RNN.hpp"
+#include "RNNSpec.hpp"
+#include <vector>
+
+namespace neuralnetwork {
+namespace rnn {
+
+struct InferenceConnection {
+  LayerConnection connection;
+  int srcIndex; // index of the source in InferenceModel::layers, -1 for the network input.
+
+  // The connection weights without the bias column. Same-timestep connections between layers have
+  // the dropout activation rate folded in.
+  EMatrix weights;
+  math::PackedMatrix packedWeights; // for steps with narrow batches.
+  EVector bias;
+
+  // When quantised the float weights are dropped and only the int8 form is used.
+  bool isQuantised;
+  math::QuantisedMatrix quantisedWeights;
+
+  InferenceConnection(const LayerConnection &connection, int srcIndex, const EMatrix &weights,
+                      const EVector &bias)
+      : connection(connection), srcIndex(srcIndex), weights(weights),
+        packedWeights(math::PackedMatrix::Pack(weights)), bias(bias), isQuantised(false) {}
+};
+
+struct InferenceLayer {
+  unsigned layerId;
+  LayerActivation activation;
+  unsigned numNodes;
+  bool isOutput;
+  bool isRecurrentSource; // whether any connection reads this layer's previous activation.
+
+  vector<InferenceConnection> incoming;
+
+  InferenceLayer(unsigned layerId, LayerActivation activation, unsigned numNodes, bool isOutput)
+      : layerId(layerId), activation(activation), numNodes(numNodes), isOutput(isOutput),
+        isRecurrentSource(false) {}
+};
+
+// An immutable snapshot of an RNN's weights, laid out for the forward pass only. Any number of
+// InferenceSessions, on any number of threads, may share one model.
+struct InferenceModel {
+  RNNSpec spec;
+  vector<InferenceLayer> layers;
+  unsigned outputIndex;
+
+  InferenceModel(const RNN &network);
+  InferenceModel(const RNNSpec &spec, const math::Tensor &weights);
+
+  // A copy of this model with every connection's weights quantised to int8 with per-row scales.
+  // Biases stay in float.
+  InferenceModel Quantised(void) const;
+};
+}
+}
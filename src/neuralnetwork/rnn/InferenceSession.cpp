@@ -0,0 +1,347 @@
+
+#include "InferenceSession.hpp"
+#include "../../math/Transcendentals.hpp"
+#include "../Activations.hpp"
+#include <cassert>
+
+using namespace neuralnetwork;
+using namespace neuralnetwork::rnn;
+
+// Prefill runs sequences through in pieces of at most this many timesteps, so that its buffers
+// can be sized once when the session is made. At this width the products stay on the small-batch
+// kernels, which unlike Eigen's blocked product allocate nothing, and are as fast per timestep.
+static constexpr unsigned PREFILL_CHUNK_STEPS = 16;
+
+size_t ColumnState::SizeBytes(void) const {
+  size_t result = sizeof(ColumnState);
+  for (const auto &layer : layers) {
+    result += sizeof(EVector) + layer.size() * sizeof(float);
+  }
+  return result;
+}
+
+struct InferenceSession::InferenceSessionImpl {
+  const InferenceModel &model;
+  const unsigned batchSize;
+
+  // Per layer (indexed as model.layers) activations for the current and previous timestep. The
+  // previous activations are only kept for layers that feed a recurrent connection.
+  vector<EMatrix> current;
+  vector<EMatrix> previous;
+  vector<EMatrix> scratch;
+
+  // 1 for columns with a previous timestep, 0 for fresh columns. Recurrent connections contribute
+  // nothing at all (not even their bias) on a column's first step, matching RNN::Process.
+  Eigen::RowVectorXf hasPrevious;
+  Eigen::RowVectorXf scratchMask;
+
+  // The output layer before its softmax, for StepLogits.
+  EMatrix logits;
+
+  // Inputs to int8 connections, quantised per column.
+  unsigned maxQuantisedCols;
+  math::QuantisedInputScratch quantisedScratch;
+
+  // Prefill buffers, PREFILL_CHUNK_STEPS columns wide. Layers that no recurrent state depends on
+  // are skipped. When a recurrent connection reads a later layer, layers cannot be run over the
+  // whole sequence one at a time.
+  vector<bool> prefillNeeded;
+  bool prefillByLayer;
+  vector<EMatrix> sequence;
+  vector<EMatrix> stepCurrent;
+  vector<EMatrix> stepPrevious;
+  EMatrix window;
+
+  InferenceSessionImpl(const InferenceModel &model, unsigned batchSize)
+      : model(model), batchSize(batchSize), hasPrevious(batchSize), scratchMask(batchSize),
+        maxQuantisedCols(0), prefillByLayer(true) {
+    assert(batchSize > 0);
+
+    for (const auto &layer : model.layers) {
+      for (const auto &connection : layer.incoming) {
+        if (connection.isQuantised) {
+          maxQuantisedCols = max(maxQuantisedCols, connection.quantisedWeights.paddedCols);
+        }
+      }
+    }
+    quantisedScratch.Reserve(maxQuantisedCols, max(batchSize, PREFILL_CHUNK_STEPS));
+
+    for (const auto &layer : model.layers) {
+      current.emplace_back(layer.numNodes, batchSize);
+
+      unsigned stateRows = layer.isRecurrentSource ? layer.numNodes : 0;
+      previous.emplace_back(stateRows, batchSize);
+      scratch.emplace_back(stateRows, batchSize);
+
+      stepCurrent.emplace_back(layer.numNodes, 1);
+      stepPrevious.emplace_back(layer.numNodes, 1);
+    }
+
+    prefillNeeded.resize(model.layers.size(), false);
+    for (int i = model.layers.size() - 1; i >= 0; i--) {
+      const InferenceLayer &layer = model.layers[i];
+      prefillNeeded[i] = prefillNeeded[i] || layer.isRecurrentSource;
+
+      for (const auto &connection : layer.incoming) {
+        if (connection.connection.timeOffset == 0) {
+          if (prefillNeeded[i] && connection.srcIndex >= 0) {
+            prefillNeeded[connection.srcIndex] = true;
+          }
+        } else if (connection.srcIndex > i) {
+          prefillByLayer = false;
+        }
+      }
+    }
+
+    unsigned windowRows = 0;
+    for (unsigned i = 0; i < model.layers.size(); i++) {
+      sequence.emplace_back(prefillNeeded[i] ? model.layers[i].numNodes : 0, PREFILL_CHUNK_STEPS);
+      windowRows = max<unsigned>(windowRows, previous[i].rows());
+    }
+    window.resize(windowRows, PREFILL_CHUNK_STEPS);
+
+    Reset();
+  }
+
+  void Reset(void) {
+    for (auto &p : previous) {
+      p.fill(0.0f);
+    }
+    hasPrevious.fill(0.0f);
+  }
+
+  void ResetColumn(unsigned column) {
+    assert(column < batchSize);
+    for (auto &p : previous) {
+      p.col(column).fill(0.0f);
+    }
+    hasPrevious(column) = 0.0f;
+  }
+
+  void ReorderColumns(const vector<unsigned> &sourceColumns) {
+    assert(sourceColumns.size() == batchSize);
+
+    for (unsigned i = 0; i < previous.size(); i++) {
+      for (unsigned c = 0; c < batchSize; c++) {
+        assert(sourceColumns[c] < batchSize);
+        scratch[i].col(c) = previous[i].col(sourceColumns[c]);
+      }
+      previous[i].swap(scratch[i]);
+    }
+
+    for (unsigned c = 0; c < batchSize; c++) {
+      scratchMask(c) = hasPrevious(sourceColumns[c]);
+    }
+    hasPrevious.swap(scratchMask);
+  }
+
+  void SaveColumn(unsigned column, ColumnState &out) const {
+    assert(column < batchSize);
+    out.layers.resize(previous.size());
+    for (unsigned i = 0; i < previous.size(); i++) {
+      out.layers[i] = previous[i].col(column);
+    }
+    out.hasPrevious = hasPrevious(column) > 0.0f;
+  }
+
+  void LoadColumn(unsigned column, const ColumnState &state) {
+    assert(column < batchSize);
+    assert(state.layers.size() == previous.size());
+    for (unsigned i = 0; i < previous.size(); i++) {
+      assert(state.layers[i].rows() == previous[i].rows());
+      previous[i].col(column) = state.layers[i];
+    }
+    hasPrevious(column) = state.hasPrevious ? 1.0f : 0.0f;
+  }
+
+  void Prefill(unsigned column, const EMatrix &inputs) {
+    assert(column < batchSize);
+    assert(inputs.rows() == model.spec.numInputs);
+
+    const int chunk = prefillByLayer ? PREFILL_CHUNK_STEPS : 1;
+    for (int start = 0; start < inputs.cols(); start += chunk) {
+      prefillLayers(column, inputs.middleCols(start, min<int>(chunk, inputs.cols() - start)));
+    }
+  }
+
+  void prefillLayers(unsigned column, const Eigen::Ref<const EMatrix> &inputs) {
+    const unsigned steps = inputs.cols();
+    const bool fresh = hasPrevious(column) == 0.0f;
+    assert(steps <= PREFILL_CHUNK_STEPS);
+
+    for (unsigned i = 0; i < model.layers.size(); i++) {
+      if (!prefillNeeded[i]) {
+        continue;
+      }
+
+      const InferenceLayer &layer = model.layers[i];
+      auto out = sequence[i].leftCols(steps);
+      out.fill(0.0f);
+
+      const InferenceConnection *selfRecurrence = nullptr;
+      for (const auto &connection : layer.incoming) {
+        if (connection.srcIndex < 0) {
+          multiplyAdd(connection, inputs, out);
+          out.colwise() += connection.bias;
+        } else if (connection.connection.timeOffset == 0) {
+          multiplyAdd(connection, sequence[connection.srcIndex].leftCols(steps), out);
+          out.colwise() += connection.bias;
+        } else if (connection.srcIndex == static_cast<int>(i)) {
+          selfRecurrence = &connection;
+        } else {
+          // The source's activations one step behind, starting from the column's saved state.
+          auto delayed = window.topLeftCorner(previous[connection.srcIndex].rows(), steps);
+          delayed.col(0) = previous[connection.srcIndex].col(column);
+          if (steps > 1) {
+            delayed.rightCols(steps - 1) = sequence[connection.srcIndex].leftCols(steps - 1);
+          }
+
+          multiplyAdd(connection, delayed, out);
+          out.rightCols(steps - 1).colwise() += connection.bias;
+          if (!fresh) {
+            out.col(0) += connection.bias;
+          }
+        }
+      }
+
+      if (selfRecurrence == nullptr) {
+        prefillActivation(layer, out);
+        continue;
+      }
+
+      EMatrix &cur = stepCurrent[i];
+      EMatrix &prev = stepPrevious[i];
+      prev.col(0) = previous[i].col(column);
+
+      for (unsigned t = 0; t < steps; t++) {
+        cur.col(0) = out.col(t);
+        if (t > 0 || !fresh) {
+          multiplyAdd(*selfRecurrence, prev, cur);
+          cur.col(0) += selfRecurrence->bias;
+        }
+
+        prefillActivation(layer, cur);
+        out.col(t) = cur.col(0);
+        prev.swap(cur);
+      }
+    }
+
+    for (unsigned i = 0; i < model.layers.size(); i++) {
+      if (model.layers[i].isRecurrentSource) {
+        previous[i].col(column) = sequence[i].col(steps - 1);
+      }
+    }
+    hasPrevious(column) = 1.0f;
+  }
+
+  // An output layer is only computed here when a recurrent connection reads it, in which case its
+  // softmax uses a temperature of 1.
+  void prefillActivation(const InferenceLayer &layer, Eigen::Ref<EMatrix> m) {
+    if (layer.isOutput && layer.activation == LayerActivation::SOFTMAX) {
+      math::SoftmaxColumns(m);
+    } else {
+      ApplyActivation(layer.activation, m);
+    }
+  }
+
+  const EMatrix &Step(const EMatrix &input, const EVector &softmaxTemperatures) {
+    assert(softmaxTemperatures.rows() == batchSize);
+    forward(input, &softmaxTemperatures);
+    return current[model.outputIndex];
+  }
+
+  const EMatrix &StepLogits(const EMatrix &input) {
+    forward(input, nullptr);
+    return model.layers[model.outputIndex].activation == LayerActivation::SOFTMAX
+               ? logits
+               : current[model.outputIndex];
+  }
+
+  // Without temperatures a softmax output layer's inputs are kept in logits. The layer itself is
+  // then normalised at a temperature of 1 in case a recurrent connection reads it.
+  void forward(const EMatrix &input, const EVector *softmaxTemperatures) {
+    assert(input.rows() == model.spec.numInputs && input.cols() == batchSize);
+
+    for (unsigned i = 0; i < model.layers.size(); i++) {
+      const InferenceLayer &layer = model.layers[i];
+      EMatrix &incoming = current[i];
+      incoming.fill(0.0f);
+
+      for (const auto &connection : layer.incoming) {
+        if (connection.srcIndex < 0) {
+          multiplyAdd(connection, input, incoming);
+          incoming.colwise() += connection.bias;
+        } else if (connection.connection.timeOffset == 0) {
+          multiplyAdd(connection, current[connection.srcIndex], incoming);
+          incoming.colwise() += connection.bias;
+        } else {
+          multiplyAdd(connection, previous[connection.srcIndex], incoming);
+          incoming.noalias() += connection.bias * hasPrevious;
+        }
+      }
+
+      if (layer.isOutput && layer.activation == LayerActivation::SOFTMAX) {
+        if (softmaxTemperatures != nullptr) {
+          math::SoftmaxColumns(incoming, *softmaxTemperatures);
+        } else {
+          logits = incoming;
+          if (layer.isRecurrentSource) {
+            math::SoftmaxColumns(incoming);
+          }
+        }
+      } else {
+        ApplyActivation(layer.activation, incoming);
+      }
+    }
+
+    for (unsigned i = 0; i < model.layers.size(); i++) {
+      if (model.layers[i].isRecurrentSource) {
+        previous[i] = current[i]; // same size, so this is a plain copy.
+      }
+    }
+    hasPrevious.fill(1.0f);
+  }
+
+  void multiplyAdd(const InferenceConnection &connection, const Eigen::Ref<const EMatrix> &src,
+                   Eigen::Ref<EMatrix> out) {
+    if (connection.isQuantised) {
+      math::QuantisedMultiplyAdd(connection.quantisedWeights, src, out, quantisedScratch);
+    } else {
+      math::AddProduct(connection.weights, connection.packedWeights, src, out);
+    }
+  }
+};
+
+InferenceSession::InferenceSession(const InferenceModel &model, unsigned batchSize)
+    : impl(new InferenceSessionImpl(model, batchSize)) {}
+
+InferenceSession::~InferenceSession() = default;
+
+unsigned InferenceSession::BatchSize(void) const { return impl->batchSize; }
+
+void InferenceSession::Reset(void) { impl->Reset(); }
+void InferenceSession::ResetColumn(unsigned column) { impl->ResetColumn(column); }
+
+void InferenceSession::ReorderColumns(const vector<unsigned> &sourceColumns) {
+  impl->ReorderColumns(sourceColumns);
+}
+
+void InferenceSession::SaveColumn(unsigned column, ColumnState &out) const {
+  impl->SaveColumn(column, out);
+}
+
+void InferenceSession::LoadColumn(unsigned column, const ColumnState &state) {
+  impl->LoadColumn(column, state);
+}
+
+const EMatrix &InferenceSession::StepLogits(const EMatrix &input) {
+  return impl->StepLogits(input);
+}
+
+void InferenceSession::Prefill(unsigned column, const EMatrix &inputs) {
+  impl->Prefill(column, inputs);
+}
+
+const EMatrix &InferenceSession::Step(const EMatrix &input, const EVector &softmaxTemperatures) {
+  return impl->Step(input, softmaxTemperatures);
+}
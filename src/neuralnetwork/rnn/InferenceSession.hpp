@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../../common/Common.hpp"
+#include "../../math/Math.hpp"
+#include "InferenceModel.hpp"
+#include <vector>
+
+namespace neuralnetwork {
+namespace rnn {
+
+// The recurrent state of one session column, detached from any session.
+struct ColumnState {
+  vector<EVector> layers; // indexed as InferenceModel::layers, empty for non-recurrent layers.
+  bool hasPrevious;
+
+  size_t SizeBytes(void) const;
+};
+
+// The recurrent state for a fixed number of independent streams (batch columns) running through a
+// shared InferenceModel. All buffers are allocated up front, a Step does no dropout or derivative
+// work and writes into preallocated memory. A session must only be used by one thread at a time,
+// and the model must outlive it.
+class InferenceSession {
+public:
+  InferenceSession(const InferenceModel &model, unsigned batchSize);
+  ~InferenceSession();
+
+  unsigned BatchSize(void) const;
+
+  void Reset(void);
+  void ResetColumn(unsigned column);
+
+  // Column i afterwards holds the state previously in column sourceColumns[i].
+  void ReorderColumns(const vector<unsigned> &sourceColumns);
+
+  // Copies a column's recurrent state out of or into the session. A loaded column continues
+  // exactly as the saved one would have.
+  void SaveColumn(unsigned column, ColumnState &out) const;
+  void LoadColumn(unsigned column, const ColumnState &state);
+
+  // Feeds a sequence of inputs (one column per timestep) through a single column, leaving it in
+  // the state the same number of Steps would have reached. Outputs are not computed. Each layer
+  // takes all timesteps of its inputs in one matrix product and only its own recurrence is run
+  // step by step, so long prompts cost far less than repeated Steps.
+  void Prefill(unsigned column, const EMatrix &inputs);
+
+  // Advances every column by one timestep and returns the output distributions, one column per
+  // stream. The returned matrix is owned by the session and overwritten by the next Step.
+  const EMatrix &Step(const EMatrix &input, const EVector &softmaxTemperatures);
+
+  // As Step, but returns the unnormalised log probabilities of a softmax output layer, for
+  // samplers that apply their own temperature.
+  const EMatrix &StepLogits(const EMatrix &input);
+
+private:
+  // Non-copyable
+  InferenceSession(const InferenceSession &other) = delete;
+  InferenceSession &operator=(const InferenceSession &) = delete;
+
+  struct InferenceSessionImpl;
+  uptr<InferenceSessionImpl> impl;
+};
+}
+}
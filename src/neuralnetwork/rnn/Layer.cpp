@@ -1,6 +1,7 @@
 
 #include "Layer.hpp"
 #include "../../math/Math.hpp"
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 
@@ -63,4 +64,34 @@ Layer::Layer(const RNNSpec &nnSpec, const LayerSpec &layerSpec)
       outgoing.push_back(lc);
     }
   }
+
+  masks.resize(weights.size());
+  PackWeights();
+}
+
+void Layer::PackWeights(void) {
+  packedWeights.resize(weights.size());
+  for (unsigned i = 0; i < weights.size(); i++) {
+    EMatrix &w = weights[i].second;
+    if (!masks[i].empty()) {
+      math::ApplyBlockMask(masks[i], w.leftCols(w.cols() - 1));
+    }
+    packedWeights[i] = math::PackedMatrix::Pack(w.leftCols(w.cols() - 1));
+  }
+}
+
+void Layer::PruneWeights(unsigned index, float density) {
+  assert(index < weights.size());
+  const EMatrix &w = weights[index].second;
+  masks[index] = math::LargestBlocks(w.leftCols(w.cols() - 1), density);
+}
+
+void Layer::MaskZeroBlocks(void) {
+  for (unsigned i = 0; i < weights.size(); i++) {
+    const EMatrix &w = weights[i].second;
+    math::BlockMask mask = math::NonZeroBlocks(w.leftCols(w.cols() - 1));
+
+    bool isDense = find(mask.begin(), mask.end(), false) == mask.end();
+    masks[i] = isDense ? math::BlockMask() : mask;
+  }
 }
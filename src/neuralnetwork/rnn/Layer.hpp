@@ -2,6 +2,7 @@
 
 #include "../../common/Common.hpp"
 #include "../../math/Math.hpp"
+#include "../../math/SmallGemm.hpp"
 #include "../Activations.hpp"
 #include "RNNSpec.hpp"
 #include <vector>
@@ -20,7 +21,24 @@ struct Layer {
   vector<pair<LayerConnection, EMatrix>> weights;
   vector<LayerConnection> outgoing;
 
+  // The weights without their bias columns, packed for the forward products. Every timestep of
+  // every trace reuses them until the weights next change.
+  vector<math::PackedMatrix> packedWeights;
+
+  // The weight blocks each connection keeps, empty for a dense connection. The pruned blocks are
+  // held at zero so that the packed weights leave them out.
+  vector<math::BlockMask> masks;
+
   Layer(const RNNSpec &nnSpec, const LayerSpec &layerSpec);
+
+  // Must be called whenever the weights change. Zeroes the pruned blocks before packing.
+  void PackWeights(void);
+
+  // Keeps the given fraction of a connection's weight blocks, those of largest magnitude.
+  void PruneWeights(unsigned index, float density);
+
+  // Prunes the blocks that are entirely zero, for weights that were pruned before being saved.
+  void MaskZeroBlocks(void);
 };
 }
 }
@@ -5,35 +5,24 @@
 using namespace neuralnetwork;
 using namespace neuralnetwork::rnn;
 
-LayerMemory::LayerMemory() : lastTimestamp(-1) {}
+LayerMemory::LayerMemory() {}
 
-// TODO: use const_cast to avoid duplication.
 const TimeSlice *LayerMemory::GetTimeSlice(int timestamp) const {
-  for (auto &ts : memory) {
-    if (ts.timestamp == timestamp) {
-      return &ts;
-    }
-  }
-
-  return nullptr;
+  auto it = memory.find(timestamp);
+  return it == memory.end() ? nullptr : &it->second;
 }
 
 TimeSlice *LayerMemory::GetTimeSlice(int timestamp) {
-  for (auto &ts : memory) {
-    if (ts.timestamp == timestamp) {
-      return &ts;
-    }
-  }
-
-  return nullptr;
+  auto it = memory.find(timestamp);
+  return it == memory.end() ? nullptr : &it->second;
 }
 
 TimeSlice *LayerMemory::PushNewSlice(const TimeSlice &slice) {
   assert(slice.timestamp >= 0);
-  assert(slice.timestamp > lastTimestamp);
 
-  memory.push_back(slice);
-  lastTimestamp = slice.timestamp;
-
-  return &memory.back();
+  auto inserted = memory.emplace(slice.timestamp, slice);
+  assert(inserted.second);
+  return &inserted.first->second;
 }
+
+void LayerMemory::ReleaseSlice(int timestamp) { memory.erase(timestamp); }
@@ -4,7 +4,7 @@
 #include "../../common/Common.hpp"
 #include "../../math/Math.hpp"
 #include "TimeSlice.hpp"
-#include <vector>
+#include <map>
 
 namespace neuralnetwork {
 namespace rnn {
@@ -16,11 +16,13 @@ public:
   const TimeSlice *GetTimeSlice(int timestamp) const;
   TimeSlice *GetTimeSlice(int timestamp);
 
+  // Slices may be pushed in any order, but each timestamp at most once. Pointers to stored slices
+  // stay valid until that slice is released.
   TimeSlice *PushNewSlice(const TimeSlice &slice);
+  void ReleaseSlice(int timestamp);
 
 private:
-  vector<TimeSlice> memory;
-  int lastTimestamp;
+  map<int, TimeSlice> memory;
 };
 }
 }
@@ -0,0 +1,139 @@
+
+#include "PrefixStateCache.hpp"
+#include <cassert>
+#include <list>
+#include <map>
+
+using namespace neuralnetwork;
+using namespace neuralnetwork::rnn;
+
+namespace {
+
+struct Node {
+  Node *parent;
+  unsigned token;
+  map<unsigned, uptr<Node>> children;
+
+  bool hasState;
+  ColumnState state;
+  std::list<Node *>::iterator lruPos;
+
+  Node(Node *parent, unsigned token) : parent(parent), token(token), hasState(false) {}
+};
+
+// Rough cost of a trie node, including its entry in the parent's child map.
+static constexpr size_t NODE_BYTES = sizeof(Node) + 48;
+}
+
+struct PrefixStateCache::PrefixStateCacheImpl {
+  const size_t maxBytes;
+
+  Node root;
+  std::list<Node *> lru; // most recently used at the front.
+  size_t curBytes;
+
+  PrefixStateCacheImpl(size_t maxBytes) : maxBytes(maxBytes), root(nullptr, 0), curBytes(0) {}
+
+  bool Lookup(const vector<unsigned> &tokens, unsigned maxLength, unsigned &outLength,
+              ColumnState &outState) {
+    maxLength = min<unsigned>(maxLength, tokens.size());
+
+    Node *best = root.hasState ? &root : nullptr;
+    unsigned bestLength = 0;
+
+    Node *cur = &root;
+    for (unsigned i = 0; i < maxLength; i++) {
+      auto child = cur->children.find(tokens[i]);
+      if (child == cur->children.end()) {
+        break;
+      }
+
+      cur = child->second.get();
+      if (cur->hasState) {
+        best = cur;
+        bestLength = i + 1;
+      }
+    }
+
+    if (best == nullptr) {
+      return false;
+    }
+
+    lru.splice(lru.begin(), lru, best->lruPos);
+    outLength = bestLength;
+    outState = best->state;
+    return true;
+  }
+
+  void Insert(const vector<unsigned> &tokens, unsigned length, const ColumnState &state) {
+    assert(length <= tokens.size());
+
+    Node *cur = &root;
+    for (unsigned i = 0; i < length; i++) {
+      uptr<Node> &child = cur->children[tokens[i]];
+      if (!child) {
+        child.reset(new Node(cur, tokens[i]));
+        curBytes += NODE_BYTES;
+      }
+      cur = child.get();
+    }
+
+    if (cur->hasState) {
+      lru.splice(lru.begin(), lru, cur->lruPos);
+    } else {
+      cur->hasState = true;
+      cur->state = state;
+      curBytes += state.SizeBytes();
+
+      lru.push_front(cur);
+      cur->lruPos = lru.begin();
+    }
+
+    while (curBytes > maxBytes && !lru.empty()) {
+      evict(lru.back());
+    }
+  }
+
+  void Clear(void) {
+    while (!lru.empty()) {
+      evict(lru.back());
+    }
+  }
+
+  void evict(Node *node) {
+    assert(node->hasState);
+    lru.erase(node->lruPos);
+    curBytes -= node->state.SizeBytes();
+    node->hasState = false;
+    node->state = ColumnState();
+
+    // Drop the branch up to the nearest node that is still needed.
+    while (node != &root && !node->hasState && node->children.empty()) {
+      Node *parent = node->parent;
+      unsigned token = node->token; // the erase destroys node.
+      parent->children.erase(token);
+      curBytes -= NODE_BYTES;
+      node = parent;
+    }
+  }
+};
+
+PrefixStateCache::PrefixStateCache(size_t maxBytes) : impl(new PrefixStateCacheImpl(maxBytes)) {}
+
+PrefixStateCache::~PrefixStateCache() = default;
+
+bool PrefixStateCache::Lookup(const vector<unsigned> &tokens, unsigned maxLength,
+                              unsigned &outLength, ColumnState &outState) {
+  return impl->Lookup(tokens, maxLength, outLength, outState);
+}
+
+void PrefixStateCache::Insert(const vector<unsigned> &tokens, unsigned length,
+                              const ColumnState &state) {
+  impl->Insert(tokens, length, state);
+}
+
+void PrefixStateCache::Clear(void) { impl->Clear(); }
+
+unsigned PrefixStateCache::NumStates(void) const { return impl->lru.size(); }
+
+size_t PrefixStateCache::SizeBytes(void) const { return impl->curBytes; }
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "../../common/Common.hpp"
+#include "InferenceSession.hpp"
+#include <vector>
+
+namespace neuralnetwork {
+namespace rnn {
+
+// Remembers the recurrent state reached after feeding token prefixes, so a prompt that shares a
+// prefix with an earlier one only has to run the remaining tokens. Prefixes are stored in a trie
+// and states are evicted least recently used first once their total size exceeds the budget.
+// Not thread safe.
+class PrefixStateCache {
+public:
+  PrefixStateCache(size_t maxBytes);
+  ~PrefixStateCache();
+
+  // Finds the longest cached prefix of tokens that is at most maxLength long. On a hit, returns
+  // true and writes the prefix length and its state.
+  bool Lookup(const vector<unsigned> &tokens, unsigned maxLength, unsigned &outLength,
+              ColumnState &outState);
+
+  // Stores the state reached after the first length tokens.
+  void Insert(const vector<unsigned> &tokens, unsigned length, const ColumnState &state);
+
+  void Clear(void);
+
+  unsigned NumStates(void) const;
+  size_t SizeBytes(void) const;
+
+private:
+  // Non-copyable
+  PrefixStateCache(const PrefixStateCache &other) = delete;
+  PrefixStateCache &operator=(const PrefixStateCache &) = delete;
+
+  struct PrefixStateCacheImpl;
+  uptr<PrefixStateCacheImpl> impl;
+};
+}
+}
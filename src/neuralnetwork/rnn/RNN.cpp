@@ -1,6 +1,8 @@
 
 #include "RNN.hpp"
 #include "../../common/Maybe.hpp"
+#include "../../math/SmallGemm.hpp"
+#include "../../math/Transcendentals.hpp"
 #include "../Activations.hpp"
 #include "DeltaAccum.hpp"
 #include "GradientAccum.hpp"
@@ -23,10 +25,7 @@ struct RNN::RNNImpl {
   vector<Layer> layers;
   Maybe<TimeSlice> previous;
 
-  float softmaxTemperature;
-
-  RNNImpl(const RNNSpec &spec)
-      : spec(spec), previous(Maybe<TimeSlice>::none), softmaxTemperature(1.0f) {
+  RNNImpl(const RNNSpec &spec) : spec(spec), previous(Maybe<TimeSlice>::none) {
     for (const auto &ls : spec.layers) {
       layers.emplace_back(spec, ls);
     }
@@ -37,39 +36,63 @@ struct RNN::RNNImpl {
 
   void ClearMemory(void) { previous = Maybe<TimeSlice>::none; }
 
-  EMatrix Process(const EMatrix &input, float softmaxTemperature) {
+  EMatrix Process(const EMatrix &input, const EVector &softmaxTemperatures) {
     assert(input.rows() == spec.numInputs);
     assert(input.cols() > 0);
-
-    this->softmaxTemperature = softmaxTemperature;
+    assert(softmaxTemperatures.rows() == input.cols());
 
     TimeSlice *prevSlice = previous.valid() ? &(previous.val()) : nullptr;
     TimeSlice curSlice(0, input, layers);
 
-    EMatrix output = forwardPass(prevSlice, curSlice, false);
+    EMatrix output = forwardPass(prevSlice, curSlice, false, 0, &softmaxTemperatures);
     previous = Maybe<TimeSlice>(curSlice);
     return output;
   }
 
-  math::Tensor ComputeGradient(const vector<SliceBatch> &trace) {
+  math::Tensor ComputeGradient(const vector<SliceBatch> &trace, unsigned checkpointInterval) {
     assert(trace.size() > 0);
     assert(trace.front().batchInput.cols() > 0);
 
+    // With activation checkpointing only the last slice of every segment of checkpointInterval
+    // slices is kept after the forward pass. The rest of a segment is recomputed from the
+    // preceding checkpoint during the backward sweep, so memory grows with
+    // (trace length / interval + interval) slices rather than with the trace length. Dropout
+    // masks are derived from a hash rather than drawn, so recomputed slices match exactly.
+    const unsigned interval = max(checkpointInterval, 1u);
+    const unsigned dropoutSeed = rand();
+
     BackpropContext bpContext;
 
     // Forward pass
-    TimeSlice *prevSlice = nullptr;
+    Maybe<TimeSlice> unstored;
+    const TimeSlice *prevSlice = nullptr;
     for (unsigned i = 0; i < trace.size(); i++) {
       TimeSlice curSlice(i, trace[i].batchInput, layers);
+      forwardPass(prevSlice, curSlice, true, dropoutSeed, nullptr);
 
-      forwardPass(prevSlice, curSlice, true);
-      prevSlice = bpContext.memory.PushNewSlice(curSlice);
+      if (isCheckpointSlice(i, interval, trace.size())) {
+        prevSlice = bpContext.memory.PushNewSlice(curSlice);
+      } else {
+        unstored = Maybe<TimeSlice>(std::move(curSlice));
+        prevSlice = &unstored.val();
+      }
     }
+    unstored = Maybe<TimeSlice>::none;
 
-    // Backward pass
+    // Backward pass, one segment at a time starting from the end of the trace.
     float totalLoss = 0.0f;
-    for (int i = (trace.size() - 1); i >= 0; i--) {
-      totalLoss += backprop(trace[i], i, bpContext);
+    int segmentStart = ((trace.size() - 1) / interval) * interval;
+    for (; segmentStart >= 0; segmentStart -= interval) {
+      int segmentEnd = min<int>(segmentStart + interval, trace.size()) - 1;
+      recomputeSegment(trace, segmentStart, segmentEnd, dropoutSeed, bpContext);
+
+      for (int i = segmentEnd; i >= segmentStart; i--) {
+        totalLoss += backprop(trace[i], i, bpContext);
+
+        // Nothing earlier in the trace refers to this timestamp's activations or deltas.
+        bpContext.memory.ReleaseSlice(i);
+        bpContext.deltaAccum.ReleaseDeltas(i);
+      }
     }
 
     // Compile the accumulated weight deltas into a gradient tensor.
@@ -88,12 +111,66 @@ struct RNN::RNNImpl {
     return result;
   }
 
+  math::Tensor GetWeights(void) const {
+    math::Tensor result;
+    for (const auto &layer : layers) {
+      for (const auto &weight : layer.weights) {
+        result.AddLayer(weight.second);
+      }
+    }
+    return result;
+  }
+
+  void SetWeights(const math::Tensor &weights) {
+    unsigned index = 0;
+    for (auto &layer : layers) {
+      for (auto &weight : layer.weights) {
+        assert(index < weights.NumLayers());
+        assert(weight.second.rows() == weights(index).rows());
+        assert(weight.second.cols() == weights(index).cols());
+        weight.second = weights(index++);
+      }
+      layer.MaskZeroBlocks();
+      layer.PackWeights();
+    }
+    assert(index == weights.NumLayers());
+  }
+
   void UpdateWeights(const math::Tensor &weightsDelta) {
     unsigned index = 0;
     for (auto &layer : layers) {
       for (auto &weight : layer.weights) {
         weight.second += weightsDelta(index++);
       }
+      layer.PackWeights();
+    }
+  }
+
+  void PruneRecurrent(float density) {
+    for (auto &layer : layers) {
+      for (unsigned i = 0; i < layer.weights.size(); i++) {
+        if (layer.weights[i].first.timeOffset == 1) {
+          layer.PruneWeights(i, density);
+        }
+      }
+      layer.PackWeights();
+    }
+  }
+
+  bool isCheckpointSlice(unsigned timestamp, unsigned interval, unsigned traceLength) const {
+    return (timestamp + 1) % interval == 0 || timestamp + 1 == traceLength;
+  }
+
+  // Recreates the non-checkpoint slices in [start, end) from the checkpoint preceding start.
+  void recomputeSegment(const vector<SliceBatch> &trace, int start, int end, unsigned dropoutSeed,
+                        BackpropContext &bpContext) {
+    const TimeSlice *prevSlice = bpContext.memory.GetTimeSlice(start - 1);
+    assert(start == 0 || prevSlice != nullptr);
+
+    for (int i = start; i < end; i++) {
+      TimeSlice curSlice(i, trace[i].batchInput, layers);
+      forwardPass(prevSlice, curSlice, true, dropoutSeed, nullptr);
+      prevSlice = bpContext.memory.PushNewSlice(curSlice);
     }
   }
 
@@ -118,7 +195,9 @@ struct RNN::RNNImpl {
   void recursiveBackprop(const Layer &layer, int timestamp, const EMatrix &delta,
                          BackpropContext &bpContext) {
 
-    for (const auto &connection : layer.weights) {
+    for (unsigned i = 0; i < layer.weights.size(); i++) {
+      const auto &connection = layer.weights[i];
+      const math::PackedMatrix &packed = layer.packedWeights[i];
       int srcTimestamp = timestamp - connection.first.timeOffset;
 
       const TimeSlice *srcSlice = bpContext.memory.GetTimeSlice(srcTimestamp);
@@ -127,23 +206,21 @@ struct RNN::RNNImpl {
       }
 
       if (connection.first.srcLayerId == 0) { // The source is the input.
-        EMatrix inputT = getInputWithBias(srcSlice->networkInput).transpose();
-        bpContext.gradientAccum.IncrementWeights(connection.first, delta * inputT);
+        bpContext.gradientAccum.IncrementWeights(connection.first, packed, delta,
+                                                 srcSlice->networkInput);
       } else { // The source is another layer from the srcSlice.
         const Layer &srcLayer = findLayer(connection.first.srcLayerId);
         const ConnectionMemoryData *cmd = srcSlice->GetConnectionData(connection.first);
         assert(cmd != nullptr && cmd->haveActivation);
 
         // Accumulate the gradient for the connection weight.
-        EMatrix inputT = getInputWithBias(cmd->activation).transpose();
-        bpContext.gradientAccum.IncrementWeights(connection.first, delta * inputT);
+        bpContext.gradientAccum.IncrementWeights(connection.first, packed, delta, cmd->activation);
 
-        // Now increment the delta for the src layer.
-        int nRows = connection.second.rows();
-        int nCols = connection.second.cols() - 1;
-        EMatrix noBiasWeights = connection.second.bottomLeftCorner(nRows, nCols);
-        EMatrix srcDelta = noBiasWeights.transpose() * delta;
-        assert(srcLayer.numNodes == srcDelta.rows());
+        // Now increment the delta for the src layer, the bias column does not contribute.
+        assert(srcLayer.numNodes == connection.second.cols() - 1);
+        EMatrix srcDelta = EMatrix::Zero(srcLayer.numNodes, delta.cols());
+        math::AddProductTransA(connection.second.leftCols(srcLayer.numNodes), packed, delta,
+                               srcDelta);
 
         componentScale(srcDelta, cmd->derivative);
         LayerAccum &deltaAccum =
@@ -178,11 +255,18 @@ struct RNN::RNNImpl {
     return layers.back();
   }
 
-  EMatrix forwardPass(const TimeSlice *prevSlice, TimeSlice &curSlice, bool doDropout) {
+  // softmaxTemperatures holds a temperature per batch column, or is null for training.
+  EMatrix forwardPass(const TimeSlice *prevSlice, TimeSlice &curSlice, bool doDropout,
+                      unsigned dropoutSeed, const EVector *softmaxTemperatures) {
+    unsigned connectionIndex = 0;
     for (const auto &layer : layers) {
-      pair<EMatrix, EMatrix> layerOut = getLayerOutput(layer, prevSlice, curSlice);
+      pair<EMatrix, EMatrix> layerOut =
+          getLayerOutput(layer, prevSlice, curSlice, softmaxTemperatures);
 
       for (const auto &oc : layer.outgoing) {
+        unsigned dropoutKey = dropoutSeed ^ (curSlice.timestamp * 0x9E3779B9u) ^
+                              (connectionIndex++ * 0x85EBCA6Bu);
+
         ConnectionMemoryData *cmd = curSlice.GetConnectionData(oc);
         assert(cmd != nullptr);
 
@@ -192,7 +276,7 @@ struct RNN::RNNImpl {
 
         // only apply dropout for non-skip recurrent connections.
         if (doDropout && oc.timeOffset == 0) {
-          applyDropout(cmd->activation, cmd->derivative);
+          applyDropout(cmd->activation, cmd->derivative, dropoutKey);
         }
 
         if (!doDropout && oc.timeOffset == 0) {
@@ -209,10 +293,10 @@ struct RNN::RNNImpl {
     return curSlice.networkOutput;
   }
 
-  void applyDropout(EMatrix &activation, EMatrix &derivative) {
+  void applyDropout(EMatrix &activation, EMatrix &derivative, unsigned key) {
     for (int r = 0; r < activation.rows(); r++) {
       for (int c = 0; c < activation.cols(); c++) {
-        if (math::UnitRand() > spec.nodeActivationRate) {
+        if (math::HashUnitRand(key, r * activation.cols() + c) > spec.nodeActivationRate) {
           activation(r, c) = 0.0f;
           derivative(r, c) = 0.0f;
         }
@@ -222,24 +306,27 @@ struct RNN::RNNImpl {
 
   // Returns the output vector of the layer, and the derivative vector for the layer.
   pair<EMatrix, EMatrix> getLayerOutput(const Layer &layer, const TimeSlice *prevSlice,
-                                        const TimeSlice &curSlice) {
+                                        const TimeSlice &curSlice,
+                                        const EVector *softmaxTemperatures) {
     EMatrix incoming(layer.numNodes, curSlice.networkInput.cols());
     incoming.fill(0.0f);
 
-    for (const auto &connection : layer.weights) {
-      incrementIncomingWithConnection(connection, prevSlice, curSlice, incoming);
+    for (unsigned i = 0; i < layer.weights.size(); i++) {
+      incrementIncomingWithConnection(layer, i, prevSlice, curSlice, incoming);
     }
 
-    return performLayerActivations(layer, incoming);
+    return performLayerActivations(layer, incoming, softmaxTemperatures);
   }
 
-  void incrementIncomingWithConnection(const pair<LayerConnection, EMatrix> &connection,
+  void incrementIncomingWithConnection(const Layer &layer, unsigned index,
                                        const TimeSlice *prevSlice, const TimeSlice &curSlice,
                                        EMatrix &incoming) {
+    const auto &connection = layer.weights[index];
+    const math::PackedMatrix &packed = layer.packedWeights[index];
 
     if (connection.first.srcLayerId == 0) { // special case for input
       assert(connection.first.timeOffset == 0);
-      incoming += connection.second * getInputWithBias(curSlice.networkInput);
+      addWeightedInput(connection.second, packed, curSlice.networkInput, incoming);
     } else {
       const ConnectionMemoryData *connectionMemory = nullptr;
 
@@ -253,23 +340,26 @@ struct RNN::RNNImpl {
 
       if (connectionMemory != nullptr) {
         assert(connectionMemory->haveActivation);
-        incoming += connection.second * getInputWithBias(connectionMemory->activation);
+        addWeightedInput(connection.second, packed, connectionMemory->activation, incoming);
       }
     }
   }
 
-  pair<EMatrix, EMatrix> performLayerActivations(const Layer &layer, const EMatrix &incoming) {
-    EMatrix activation(incoming.rows(), incoming.cols());
+  pair<EMatrix, EMatrix> performLayerActivations(const Layer &layer, const EMatrix &incoming,
+                                                 const EVector *softmaxTemperatures) {
+    EMatrix activation = incoming;
     EMatrix derivatives(incoming.rows(), incoming.cols());
 
     if (layer.isOutput && spec.outputActivation == LayerActivation::SOFTMAX) {
-      for (int c = 0; c < activation.cols(); c++) {
-        activation.col(c) = math::SoftmaxActivations(incoming.col(c) / softmaxTemperature);
+      if (softmaxTemperatures != nullptr) {
+        math::SoftmaxColumns(activation, *softmaxTemperatures);
+      } else {
+        math::SoftmaxColumns(activation);
       }
     } else {
+      ApplyActivation(spec.hiddenActivation, activation);
       for (int c = 0; c < activation.cols(); c++) {
         for (int r = 0; r < activation.rows(); r++) {
-          activation(r, c) = ActivationValue(spec.hiddenActivation, incoming(r, c));
           derivatives(r, c) =
               ActivationDerivative(spec.hiddenActivation, incoming(r, c), activation(r, c));
         }
@@ -279,11 +369,13 @@ struct RNN::RNNImpl {
     return make_pair(activation, derivatives);
   }
 
-  EMatrix getInputWithBias(const EMatrix &noBiasInput) const {
-    EMatrix result(noBiasInput.rows() + 1, noBiasInput.cols());
-    result.topRightCorner(noBiasInput.rows(), result.cols()) = noBiasInput;
-    result.bottomRightCorner(1, result.cols()).fill(1.0f);
-    return result;
+  // incoming += weights * [input; 1], without building the input with its bias row. packed holds
+  // the weights without the bias column.
+  void addWeightedInput(const EMatrix &weights, const math::PackedMatrix &packed,
+                        const EMatrix &input, EMatrix &incoming) const {
+    assert(weights.cols() == input.rows() + 1);
+    math::AddProduct(weights.leftCols(input.rows()), packed, input, incoming);
+    incoming.colwise() += weights.col(input.rows());
   }
 };
 
@@ -297,15 +389,25 @@ RNN &RNN::operator=(const RNN &other) {
   return *this;
 }
 
+const RNNSpec &RNN::GetSpec(void) const { return impl->spec; }
+math::Tensor RNN::GetWeights(void) const { return impl->GetWeights(); }
+void RNN::SetWeights(const math::Tensor &weights) { impl->SetWeights(weights); }
+
 void RNN::ClearMemory(void) { impl->ClearMemory(); }
 EMatrix RNN::Process(const EMatrix &input, float softmaxTemperature) {
-  return impl->Process(input, softmaxTemperature);
+  return impl->Process(input, EVector::Constant(input.cols(), softmaxTemperature));
 }
 
-math::Tensor RNN::ComputeGradient(const vector<SliceBatch> &trace) {
-  return impl->ComputeGradient(trace);
+EMatrix RNN::Process(const EMatrix &input, const EVector &softmaxTemperatures) {
+  return impl->Process(input, softmaxTemperatures);
 }
 
+math::Tensor RNN::ComputeGradient(const vector<SliceBatch> &trace, unsigned checkpointInterval) {
+  return impl->ComputeGradient(trace, checkpointInterval);
+}
+
+void RNN::PruneRecurrent(float density) { impl->PruneRecurrent(density); }
+
 void RNN::UpdateWeights(const math::Tensor &weightsDelta) {
   return impl->UpdateWeights(weightsDelta);
 }
@@ -26,12 +26,28 @@ public:
 
   RNN &operator=(const RNN &other);
 
+  const RNNSpec &GetSpec(void) const;
+
+  // The weights of every connection, in the same order as the gradient tensor.
+  math::Tensor GetWeights(void) const;
+  void SetWeights(const math::Tensor &weights);
+
   void ClearMemory(void);
+
   EMatrix Process(const EMatrix &input, float softmaxTemperature);
+  // Each input column is an independent stream with its own output softmax temperature.
+  EMatrix Process(const EMatrix &input, const EVector &softmaxTemperatures);
 
-  math::Tensor ComputeGradient(const vector<SliceBatch> &trace);
+  // A checkpointInterval of k > 1 keeps only every k-th time slice during the forward pass and
+  // recomputes the rest in the backward pass, trading extra compute for bounded memory.
+  // 0 keeps every slice.
+  math::Tensor ComputeGradient(const vector<SliceBatch> &trace, unsigned checkpointInterval);
   void UpdateWeights(const math::Tensor &weightsDelta);
 
+  // Keeps the given fraction of every recurrent connection's weight blocks, those of largest
+  // magnitude, and holds the rest at zero through later updates until the next call.
+  void PruneRecurrent(float density);
+
 private:
   struct RNNImpl;
   uptr<RNNImpl> impl;
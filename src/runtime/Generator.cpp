@@ -0,0 +1,187 @@
+
+#include "Generator.hpp"
+
+#include <cassert>
+#include <cmath>
+
+using namespace runtime;
+
+static void activate(Activation activation, vector<float> &values) {
+  for (float &v : values) {
+    switch (activation) {
+    case Activation::TANH:
+      v = tanhf(v);
+      break;
+    case Activation::LOGISTIC:
+      v = 1.0f / (1.0f + expf(-v));
+      break;
+    case Activation::RELU:
+      v = v > 0.0f ? v : 0.0f;
+      break;
+    case Activation::LEAKY_RELU:
+      v = v > 0.0f ? v : 0.01f * v;
+      break;
+    case Activation::ELU:
+      v = v > 0.0f ? v : expf(v) - 1.0f;
+      break;
+    case Activation::LINEAR:
+    case Activation::SOFTMAX:
+      break;
+    }
+  }
+}
+
+static void softmax(vector<float> &values, float temperature) {
+  float maxVal = values[0];
+  for (float v : values) {
+    maxVal = fmaxf(maxVal, v);
+  }
+
+  float sum = 0.0f;
+  for (float &v : values) {
+    v = expf((v - maxVal) / temperature);
+    sum += v;
+  }
+  for (float &v : values) {
+    v /= sum;
+  }
+}
+
+struct Generator::GeneratorImpl {
+  const Model &model;
+  const ModelHeader &header;
+  std::mt19937 rng;
+
+  // Per layer activations for this step and the previous one.
+  vector<vector<float>> current;
+  vector<vector<float>> previous;
+  bool hasPrevious;
+  unsigned outputIndex;
+
+  // The output layer before any softmax.
+  vector<float> output;
+  vector<float> probabilities;
+
+  GeneratorImpl(const Model &model, unsigned seed)
+      : model(model), header(model.Header()), rng(seed), hasPrevious(false), outputIndex(0) {
+    for (unsigned i = 0; i < header.numLayers; i++) {
+      const ModelLayer &layer = model.Layer(i);
+      current.emplace_back(layer.numNodes, 0.0f);
+      previous.emplace_back(layer.numNodes, 0.0f);
+      if (layer.isOutput) {
+        outputIndex = i;
+      }
+    }
+    output.resize(current[outputIndex].size());
+    probabilities.resize(current[outputIndex].size());
+
+    Reset();
+  }
+
+  // A sequence starts with an all-zero input, as it does in training and sampling.
+  void Reset(void) {
+    hasPrevious = false;
+    step(-1);
+  }
+
+  void step(int input) {
+    for (unsigned i = 0; i < header.numLayers; i++) {
+      const ModelLayer &layer = model.Layer(i);
+      vector<float> &out = current[i];
+      fill(out.begin(), out.end(), 0.0f);
+
+      for (unsigned j = 0; j < layer.numConnections; j++) {
+        const ModelConnection &c = model.Connection(layer.firstConnection + j);
+        const float *weights = model.Data(c.weightsOffset);
+        const float *bias = model.Data(c.biasOffset);
+
+        if (c.srcLayer < 0) {
+          // A one-hot input selects a single weight column.
+          for (unsigned r = 0; r < c.rows; r++) {
+            out[r] += (input >= 0 ? weights[r * c.cols + input] : 0.0f) + bias[r];
+          }
+        } else if (c.timeOffset == 0) {
+          multiplyAdd(weights, bias, c.rows, c.cols, current[c.srcLayer].data(), out);
+        } else if (hasPrevious) {
+          multiplyAdd(weights, bias, c.rows, c.cols, previous[c.srcLayer].data(), out);
+        }
+      }
+
+      Activation activation = static_cast<Activation>(layer.activation);
+      if (!layer.isOutput) {
+        activate(activation, out);
+        continue;
+      }
+
+      // A softmax is left to Sample, which knows the temperature.
+      if (activation != Activation::SOFTMAX) {
+        activate(activation, out);
+      }
+      output = out;
+      if (activation == Activation::SOFTMAX && layer.isRecurrentSource) {
+        softmax(out, 1.0f);
+      }
+    }
+
+    for (unsigned i = 0; i < header.numLayers; i++) {
+      if (model.Layer(i).isRecurrentSource) {
+        previous[i] = current[i];
+      }
+    }
+    hasPrevious = true;
+  }
+
+  void multiplyAdd(const float *weights, const float *bias, unsigned rows, unsigned cols,
+                   const float *src, vector<float> &out) {
+    for (unsigned r = 0; r < rows; r++) {
+      const float *row = weights + r * cols;
+      float sum = bias[r];
+      for (unsigned c = 0; c < cols; c++) {
+        sum += row[c] * src[c];
+      }
+      out[r] += sum;
+    }
+  }
+
+  unsigned Sample(float temperature) {
+    assert(temperature > 0.0f);
+    const ModelLayer &outputLayer = model.Layer(outputIndex);
+
+    probabilities = output;
+    if (static_cast<Activation>(outputLayer.activation) == Activation::SOFTMAX) {
+      softmax(probabilities, temperature);
+    }
+
+    float r = std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+    unsigned result = probabilities.size() - 1;
+    for (unsigned i = 0; i < probabilities.size(); i++) {
+      r -= probabilities[i];
+      if (r < 0.0f) {
+        result = i;
+        break;
+      }
+    }
+
+    step(result);
+    return result;
+  }
+};
+
+Generator::Generator(const Model &model, unsigned seed) : impl(new GeneratorImpl(model, seed)) {}
+
+Generator::~Generator() = default;
+
+void Generator::Reset(void) { impl->Reset(); }
+
+void Generator::Feed(unsigned index) {
+  assert(index < impl->header.numInputs);
+  impl->step(index);
+}
+
+void Generator::Feed(const vector<unsigned> &indices) {
+  for (unsigned index : indices) {
+    Feed(index);
+  }
+}
+
+unsigned Generator::Sample(float temperature) { return impl->Sample(temperature); }
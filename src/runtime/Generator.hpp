@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../common/Common.hpp"
+#include "Model.hpp"
+#include <random>
+#include <vector>
+
+namespace runtime {
+
+// Generates a single stream of text from a Model. Uses plain loops over the mapped weights, all
+// buffers are allocated on construction.
+class Generator {
+public:
+  Generator(const Model &model, unsigned seed);
+  ~Generator();
+
+  // Back to the start of a sequence, before any character has been fed.
+  void Reset(void);
+
+  // Advances the network by one character (a vocabulary index).
+  void Feed(unsigned index);
+  void Feed(const vector<unsigned> &indices);
+
+  // Draws the next character from the current output at the given softmax temperature, feeds it
+  // and returns it.
+  unsigned Sample(float temperature);
+
+private:
+  // Non-copyable
+  Generator(const Generator &other) = delete;
+  Generator &operator=(const Generator &) = delete;
+
+  struct GeneratorImpl;
+  uptr<GeneratorImpl> impl;
+};
+}
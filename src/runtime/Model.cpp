@@ -0,0 +1,180 @@
+
+#include "Model.hpp"
+
+#include <cassert>
+#include <cctype>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace runtime;
+
+struct Model::ModelImpl {
+  const char *base;
+  uint64_t size;
+
+  ModelImpl() : base(nullptr), size(0) {}
+
+  ~ModelImpl() {
+    if (base != nullptr) {
+      munmap(const_cast<char *>(base), size);
+    }
+  }
+
+  const ModelHeader &header(void) const { return *reinterpret_cast<const ModelHeader *>(base); }
+
+  const ModelLayer *layers(void) const {
+    return reinterpret_cast<const ModelLayer *>(base + header().layersOffset);
+  }
+
+  const ModelConnection *connections(void) const {
+    return reinterpret_cast<const ModelConnection *>(base + header().connectionsOffset);
+  }
+
+  bool contains(uint64_t offset, uint64_t bytes) const {
+    return offset <= size && bytes <= size - offset;
+  }
+
+  bool isValid(void) const {
+    if (size < sizeof(ModelHeader)) {
+      return false;
+    }
+
+    const ModelHeader &h = header();
+    if (memcmp(h.magic, MODEL_MAGIC, sizeof(h.magic)) != 0 || h.version != MODEL_VERSION ||
+        h.fileSize != size || h.vocabularySize != h.numInputs || h.numLayers == 0 ||
+        !contains(h.vocabularyOffset, h.vocabularySize) ||
+        !contains(h.layersOffset, h.numLayers * sizeof(ModelLayer)) ||
+        !contains(h.connectionsOffset, h.numConnections * sizeof(ModelConnection))) {
+      return false;
+    }
+
+    unsigned numOutputLayers = 0;
+    for (unsigned i = 0; i < h.numLayers; i++) {
+      const ModelLayer &layer = layers()[i];
+      if (layer.firstConnection > h.numConnections ||
+          layer.numConnections > h.numConnections - layer.firstConnection ||
+          layer.activation > static_cast<uint32_t>(Activation::SOFTMAX)) {
+        return false;
+      }
+
+      // Sample draws an index into the vocabulary from the output layer.
+      if (layer.isOutput) {
+        numOutputLayers++;
+        if (layer.numNodes != h.vocabularySize) {
+          return false;
+        }
+      }
+
+      for (unsigned j = 0; j < layer.numConnections; j++) {
+        const ModelConnection &c = connections()[layer.firstConnection + j];
+        if (!isValidSource(c, i)) {
+          return false;
+        }
+
+        unsigned srcNodes = c.srcLayer < 0 ? h.numInputs : layers()[c.srcLayer].numNodes;
+        if (c.rows != layer.numNodes || c.cols != srcNodes ||
+            c.weightsOffset % MODEL_ALIGNMENT != 0 || c.biasOffset % MODEL_ALIGNMENT != 0 ||
+            !contains(c.weightsOffset, static_cast<uint64_t>(c.rows) * c.cols * sizeof(float)) ||
+            !contains(c.biasOffset, c.rows * sizeof(float))) {
+          return false;
+        }
+      }
+    }
+
+    return numOutputLayers == 1;
+  }
+
+  // Whether a connection into the given layer reads the input, an earlier layer in the same step,
+  // or a recurrent source in the previous step. Only then may its source layer be indexed.
+  bool isValidSource(const ModelConnection &c, unsigned layer) const {
+    if (c.srcLayer == -1) {
+      return true;
+    }
+    if (c.srcLayer < 0 || c.srcLayer >= static_cast<int>(header().numLayers)) {
+      return false;
+    }
+    if (c.timeOffset == 0) {
+      return c.srcLayer < static_cast<int>(layer);
+    }
+    return c.timeOffset == 1 && layers()[c.srcLayer].isRecurrentSource;
+  }
+};
+
+uptr<Model> Model::Load(const string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  void *mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) {
+    return nullptr;
+  }
+
+  uptr<Model> result(new Model());
+  result->impl->base = static_cast<const char *>(mapped);
+  result->impl->size = st.st_size;
+
+  if (!result->impl->isValid()) {
+    return nullptr;
+  }
+  return result;
+}
+
+Model::Model() : impl(new ModelImpl()) {}
+
+Model::~Model() = default;
+
+const ModelHeader &Model::Header(void) const { return impl->header(); }
+
+const ModelLayer &Model::Layer(unsigned index) const {
+  assert(index < impl->header().numLayers);
+  return impl->layers()[index];
+}
+
+const ModelConnection &Model::Connection(unsigned index) const {
+  assert(index < impl->header().numConnections);
+  return impl->connections()[index];
+}
+
+const float *Model::Data(uint64_t offset) const {
+  assert(offset < impl->size);
+  return reinterpret_cast<const float *>(impl->base + offset);
+}
+
+char Model::Character(unsigned index) const {
+  assert(index < impl->header().vocabularySize);
+  return impl->base[impl->header().vocabularyOffset + index];
+}
+
+vector<unsigned> Model::Encode(const string &text) const {
+  const ModelHeader &h = impl->header();
+  const char *vocabulary = impl->base + h.vocabularyOffset;
+
+  vector<unsigned> result;
+  int prevChar = 0;
+  for (unsigned char c : text) {
+    int nextChar = isspace(c) ? ' ' : tolower(c);
+    if (nextChar == ' ' && nextChar == prevChar) {
+      continue;
+    }
+
+    const char *mapped = static_cast<const char *>(memchr(vocabulary, nextChar, h.vocabularySize));
+    if (mapped != nullptr) {
+      prevChar = nextChar;
+      result.push_back(mapped - vocabulary);
+    }
+  }
+  return result;
+}
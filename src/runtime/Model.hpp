@@ -0,0 +1,39 @@
+#pragma once
+
+#include "../common/Common.hpp"
+#include "ModelFormat.hpp"
+#include <string>
+#include <vector>
+
+namespace runtime {
+
+// A read-only view of a memory mapped model file. Loading only checks that the tables and arrays
+// lie inside the file, nothing is copied or parsed.
+class Model {
+public:
+  // Returns null if the file cannot be mapped or is not a valid model.
+  static uptr<Model> Load(const string &path);
+  ~Model();
+
+  const ModelHeader &Header(void) const;
+  const ModelLayer &Layer(unsigned index) const;
+  const ModelConnection &Connection(unsigned index) const;
+  const float *Data(uint64_t offset) const;
+
+  char Character(unsigned index) const;
+
+  // Maps text to vocabulary indices the way the training stream does: whitespace becomes a single
+  // space, letters are lower cased and characters outside the vocabulary are dropped.
+  vector<unsigned> Encode(const string &text) const;
+
+private:
+  Model();
+
+  // Non-copyable
+  Model(const Model &other) = delete;
+  Model &operator=(const Model &) = delete;
+
+  struct ModelImpl;
+  uptr<ModelImpl> impl;
+};
+}
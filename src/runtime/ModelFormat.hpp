@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+
+// The layout of an exported model file, shared by the exporter and the runtime.
+//
+// A model file is a ModelHeader, the vocabulary, a ModelLayer table, a ModelConnection table and
+// then the float data. Layers are stored in evaluation order with their incoming connections
+// contiguous in the connection table. Weights are row-major with the dropout activation rate
+// already folded in, biases are separate, and every array starts on a MODEL_ALIGNMENT boundary.
+// All offsets are from the start of the file and values are in host byte order.
+namespace runtime {
+
+static constexpr char MODEL_MAGIC[8] = {'C', 'R', 'N', 'N', 'M', 'D', 'L', '\0'};
+static constexpr uint32_t MODEL_VERSION = 1;
+static constexpr uint64_t MODEL_ALIGNMENT = 64;
+
+enum class Activation : uint32_t { TANH, LOGISTIC, RELU, LEAKY_RELU, ELU, LINEAR, SOFTMAX };
+
+struct ModelHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t numInputs;
+  uint32_t numOutputs;
+  uint32_t vocabularySize;
+  uint32_t numLayers;
+  uint32_t numConnections;
+
+  uint64_t vocabularyOffset;
+  uint64_t layersOffset;
+  uint64_t connectionsOffset;
+  uint64_t fileSize;
+};
+
+struct ModelLayer {
+  uint32_t numNodes;
+  uint32_t activation; // an Activation.
+  uint32_t isOutput;
+  uint32_t isRecurrentSource;
+  uint32_t firstConnection;
+  uint32_t numConnections;
+};
+
+struct ModelConnection {
+  int32_t srcLayer; // index into the layer table, -1 for the network input.
+  uint32_t timeOffset;
+  uint32_t rows;
+  uint32_t cols;
+  uint64_t weightsOffset;
+  uint64_t biasOffset;
+};
+}
@@ -0,0 +1,34 @@
+
+#include "Generator.hpp"
+#include "Model.hpp"
+
+#include <cstdlib>
+
+// A standalone sampler for exported models:
+//   charsample <model> [num chars] [temperature] [prompt]
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    cerr << "usage: " << argv[0] << " <model> [num chars] [temperature] [prompt]" << endl;
+    return 1;
+  }
+
+  uptr<runtime::Model> model = runtime::Model::Load(argv[1]);
+  if (model == nullptr) {
+    cerr << "could not load model: " << argv[1] << endl;
+    return 1;
+  }
+
+  unsigned numChars = argc > 2 ? atoi(argv[2]) : 1000;
+  float temperature = argc > 3 ? atof(argv[3]) : 0.7f;
+  string prompt = argc > 4 ? argv[4] : "";
+
+  runtime::Generator generator(*model, std::random_device()());
+  generator.Feed(model->Encode(prompt));
+
+  cout << prompt;
+  for (unsigned i = 0; i < numChars; i++) {
+    cout << model->Character(generator.Sample(temperature));
+  }
+  cout << endl;
+  return 0;
+}